@@ -0,0 +1,133 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef ABC_H
+#define ABC_H
+
+/* An adaptive batching controller for a byte queue. It picks how many
+ * bytes the consumer takes per bq_popbuf and how many bytes the producer
+ * accumulates before a bq_push, so that the handoff latency stays within
+ * a budget while the batches are as big as that budget allows.
+ * Some notable facts:
+ * 1: The consumer feeds the controller after each pop. The controller
+ *      keeps an exponential moving average of the occupancy of the queue
+ *      (tail - head) and of the consumer throughput, and estimates the
+ *      latency with Little's law: occupancy / throughput. The bytes the
+ *      producer holds before publishing wait too, so the producer batch
+ *      is added to the occupancy.
+ * 2: Every ABC_PERIOD updates the batches are adjusted, multiplicative
+ *      in both directions: over budget, the consumer batch doubles (to
+ *      drain faster, paying less per byte) and the producer batch halves
+ *      (so bytes are handed off sooner); under half the budget, the
+ *      producer batch doubles. The consumer batch never shrinks: a
+ *      smaller one only adds pops, it does not hand bytes off sooner.
+ * 3: The producer reads its batch with a relaxed load, it is only a
+ *      hint and a stale value is harmless. The producer MUST still push
+ *      what it holds before going idle, whatever the batch.
+ * 4: Time is measured with the TSC, see pace.h.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <x86intrin.h>
+
+#include "bq.h"
+#include "pace.h"
+
+#define ABC_PERIOD  64
+// Weight of a new sample in the moving averages, as a power of 2
+#define ABC_EWMA_LG2 3
+
+typedef struct
+{
+    // Written by the consumer, read by the producer
+    _Alignas(64) size_t push_batch;
+    // Consumer private state
+    _Alignas(64) size_t pop_batch;
+    size_t min_batch, max_batch;
+    uint64_t budget_ticks;
+    uint64_t last_tsc;
+    // Moving averages, in bytes and in bytes per 2^16 ticks
+    uint64_t occupancy, rate;
+    unsigned updates;
+} abc;
+
+/* Initializes [c] to keep the handoff latency within [budget_ns], with
+ * batches between [min_batch] and [max_batch] bytes */
+static void abc_init(abc *c, uint64_t budget_ns, size_t min_batch, size_t max_batch)
+{
+    *c = (abc){.push_batch = min_batch, .pop_batch = max_batch,
+        .min_batch = min_batch, .max_batch = max_batch,
+        .budget_ticks = budget_ns * pace_tsc_per_ns(), .last_tsc = __rdtsc()};
+}
+
+/* Producer side: returns how many bytes to accumulate before a bq_push */
+static size_t abc_push_batch(const abc *c)
+{
+    return __atomic_load_n(&c->push_batch, __ATOMIC_RELAXED);
+}
+
+/* Consumer side: returns how many of the [len] bytes returned by
+ * bq_popbuf to take in this operation */
+static size_t abc_pop_len(const abc *c, size_t len)
+{
+    return len < c->pop_batch ? len : c->pop_batch;
+}
+
+/* Returns the current latency estimate of [c], in TSC ticks */
+static uint64_t abc_latency(const abc *c)
+{
+    if (!c->rate) return UINT64_MAX;
+    return ((c->occupancy + c->push_batch) << 16) / c->rate;
+}
+
+/* Consumer side: feeds [c] after popping [popped] bytes from [q] */
+static void abc_update(abc *c, bq *q, size_t popped)
+{
+    uint64_t now = __rdtsc(), dt = now - c->last_tsc;
+    c->last_tsc = now;
+
+    size_t occupancy = bq_load_(&q->tail) - q->head;
+    uint64_t rate = dt ? ((uint64_t)popped << 16) / dt : 0;
+    c->occupancy += ((int64_t)occupancy - (int64_t)c->occupancy) >> ABC_EWMA_LG2;
+    c->rate += ((int64_t)rate - (int64_t)c->rate) >> ABC_EWMA_LG2;
+
+    if (++c->updates < ABC_PERIOD) return;
+    c->updates = 0;
+
+    uint64_t latency = abc_latency(c);
+    size_t push = c->push_batch, pop = c->pop_batch;
+    if (latency > c->budget_ticks)
+    {
+        pop = pop * 2 < c->max_batch ? pop * 2 : c->max_batch;
+        push = push / 2 > c->min_batch ? push / 2 : c->min_batch;
+    }
+    else if (latency < c->budget_ticks / 2)
+        push = push * 2 < c->max_batch ? push * 2 : c->max_batch;
+
+    c->pop_batch = pop;
+    __atomic_store_n(&c->push_batch, push, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -73,12 +73,76 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Threading policy, selected by defining BQ_THREADING to one of the
+ * following values before including this file:
+ * BQ_SPSC: The default. One producer thread and one consumer thread,
+ *      head and tail are accessed as described above.
+ * BQ_SINGLE: Producer and consumer are the same thread. head and tail
+ *      are accessed with plain loads and stores, so the compiler is free
+ *      to keep them in registers and to merge or reorder the accesses.
+ * BQ_CHECKED: Same as BQ_SPSC, plus every call asserts that the queue
+ *      is pushed by a single thread and popped by a single thread. The
+ *      first thread calling a side becomes its owner. Meant for debug
+ *      builds, the check is compiled out when NDEBUG is defined. A side
+ *      shared by several threads under a lock calls bq_disown before
+ *      unlocking.
+ * The policy applies to the whole translation unit. BQ_CHECKED adds the
+ * owners to the bq struct, so every translation unit and every process
+ * sharing a queue MUST use the same policy. NDEBUG does not change the
+ * layout. */
+#define BQ_SINGLE   0
+#define BQ_SPSC     1
+#define BQ_CHECKED  2
+
+#ifndef BQ_THREADING
+#define BQ_THREADING BQ_SPSC
+#endif
+
+#if BQ_THREADING == BQ_SINGLE
+#define bq_load_(p)     (*(p))
+#define bq_store_(p, v) (*(p) = (v))
+#else
+#define bq_load_(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define bq_store_(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+#if BQ_THREADING == BQ_CHECKED && !defined(NDEBUG)
+#include <assert.h>
+
+// The address of a thread local variable is a cheap and unique thread id
+static __thread char bq_thread_id_;
+
+static void bq_check_owner_(uintptr_t *owner)
+{
+    uintptr_t self = (uintptr_t)&bq_thread_id_, prev = 0;
+    if (!__atomic_compare_exchange_n(owner, &prev, self, 0,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        assert(prev == self && "bq side used by more than one thread");
+    (void)prev;
+}
+#define bq_check_(q, side) bq_check_owner_(&(q)->side)
+#else
+#define bq_check_(q, side) ((void)0)
+#endif
+
+/* Gives up the ownership of the [side], producer or consumer, of [q], so
+ * that the next thread calling it becomes its owner. Does nothing unless
+ * the policy is BQ_CHECKED. */
+#if BQ_THREADING == BQ_CHECKED && !defined(NDEBUG)
+#define bq_disown(q, side) __atomic_store_n(&(q)->side, 0, __ATOMIC_RELAXED)
+#else
+#define bq_disown(q, side) ((void)(q))
+#endif
+
 typedef struct
 {
     size_t head, tail;
     size_t mask;
     unsigned char cap_lg2;
     char *data;
+#if BQ_THREADING == BQ_CHECKED
+    uintptr_t producer, consumer;
+#endif
 } bq;
 
 /* Returns a byte queue given the buffer [buf] of size [len].
@@ -106,6 +170,7 @@ static bq bq_make(char *buf, size_t len)
  * poppable bytes and sets [*len] to the len of the buffer */
 static void *bq_popbuf(bq *q, size_t *len)
 {
+    bq_check_(q, consumer);
     // This private copy of tail is essential to have a coherent
     // value throughout the function, regardless of the consumer's
     // actions.
@@ -114,7 +179,7 @@ static void *bq_popbuf(bq *q, size_t *len)
     // If the read is also reordered before the writes of the same
     // bytes by the producer in the memory total order, the consumer
     // will read bytes not yet produced.
-    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    size_t tail = bq_load_(&q->tail);
     // The cond variable is 0 iff tail is in the same block of
     // (q->mask + 1) bytes, otherwise is:
     // -- 1, when tail is in the next block and has not wrapped around SIZE_MAX,
@@ -134,16 +199,18 @@ static void *bq_popbuf(bq *q, size_t *len)
  * total number of bytes in available the queue */
 static void bq_pop(bq *q, size_t count)
 {
+    bq_check_(q, consumer);
     // Atomic store with release consistency because we need to be
     // sure that head is updated after the producer actually copied
     // the bytes outside the queue
-    __atomic_store_n(&q->head, q->head + count, __ATOMIC_RELEASE);
+    bq_store_(&q->head, q->head + count);
 }
 
 /* Given the byte queue [q], returns a pointer to the buffer of
  * pushable bytes and sets [*len] to the len of the buffer */
 static void *bq_pushbuf(bq *q, size_t *len)
 {
+    bq_check_(q, producer);
     // This private copy of head is essential to have a coherent
     // value throughout the function, regardless of the producer's
     // actions.
@@ -152,7 +219,7 @@ static void *bq_pushbuf(bq *q, size_t *len)
     // If the write is also reordered before the read of the same
     // bytes by the consumer in the memory total order, the producer
     // will overwrite still unconsumed bytes.
-    size_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    size_t head = bq_load_(&q->head);
     // The cond variable is 0 iff tail is in the same block of
     // (q->mask + 1) bytes, otherwise is:
     // -- 1, when tail is in the next block and has not wrapped around SIZE_MAX,
@@ -172,10 +239,11 @@ static void *bq_pushbuf(bq *q, size_t *len)
  * len value returned by the last bq_pushbuf */
 static void bq_push(bq *q, size_t count)
 {
+    bq_check_(q, producer);
     // Atomic store with release consistency because we need to be
     // sure that tail is updated after the consumer actually copied
     // the bytes in the queue
-    __atomic_store_n(&q->tail, q->tail + count, __ATOMIC_RELEASE);
+    bq_store_(&q->tail, q->tail + count);
 }
 
 #endif
\ No newline at end of file
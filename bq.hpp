@@ -0,0 +1,292 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BQ_HPP
+#define BQ_HPP
+
+/* C++20 interface of bq.h. Some notable facts:
+ * 1: bqpp::ring owns its buffer, allocated with [Allocator] (a std::byte
+ *      allocator, std::pmr ones included) and freed by the destructor.
+ *      It is move only. A ring MUST NOT be moved while the other side is
+ *      using it, as the bq it wraps holds the head and tail, and a moved
+ *      from ring has capacity 0 and can only be destroyed or assigned.
+ *      A ring of capacity 0 has nothing writable nor readable.
+ * 2: writable() / readable() return the same region as bq_pushbuf /
+ *      bq_popbuf as a std::span, committed with push() / pop().
+ * 3: A region can be split in two by the end of the buffer. The
+ *      segments type holds both halves: each half is a std::span with
+ *      contiguous iterators, while the segments iterators walk both
+ *      halves as one random access range, with a compare per access.
+ * 4: write() / read() return guards over all the writable / readable
+ *      bytes. The bytes marked with commit(n) are pushed / popped when
+ *      the guard goes out of scope, once.
+ * 5: Everything is inline on top of the bq.h functions: no virtual
+ *      calls, no allocation other than the buffer.
+ */
+
+#include <bit>
+#include <compare>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <utility>
+
+// bq.h is C: compound literals are a GNU extension in C++
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#include "bq.h"
+#pragma GCC diagnostic pop
+
+namespace bqpp
+{
+
+/* A region of the ring, split in two by the end of the buffer. The
+ * second half is empty when the region does not wrap. */
+struct segments
+{
+    std::span<std::byte> first, second;
+
+    class iterator
+    {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = std::byte;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::byte *;
+        using reference = std::byte &;
+
+        iterator() = default;
+        iterator(const segments &s, size_t i)
+            : a_(s.first.data()), b_(s.second.data()), na_(s.first.size()), i_(i) {}
+
+        reference operator*() const { return i_ < na_ ? a_[i_] : b_[i_ - na_]; }
+        reference operator[](difference_type n) const { return *(*this + n); }
+
+        iterator &operator++() { i_++; return *this; }
+        iterator operator++(int) { iterator t = *this; i_++; return t; }
+        iterator &operator--() { i_--; return *this; }
+        iterator operator--(int) { iterator t = *this; i_--; return t; }
+        iterator &operator+=(difference_type n) { i_ += n; return *this; }
+        iterator &operator-=(difference_type n) { i_ -= n; return *this; }
+
+        friend iterator operator+(iterator it, difference_type n) { return it += n; }
+        friend iterator operator+(difference_type n, iterator it) { return it += n; }
+        friend iterator operator-(iterator it, difference_type n) { return it -= n; }
+        friend difference_type operator-(const iterator &x, const iterator &y)
+        {
+            return (difference_type)(x.i_ - y.i_);
+        }
+        friend bool operator==(const iterator &x, const iterator &y) { return x.i_ == y.i_; }
+        friend auto operator<=>(const iterator &x, const iterator &y) { return x.i_ <=> y.i_; }
+
+    private:
+        std::byte *a_ = nullptr, *b_ = nullptr;
+        size_t na_ = 0, i_ = 0;
+    };
+
+    size_t size() const { return first.size() + second.size(); }
+    bool empty() const { return !size(); }
+    std::byte &operator[](size_t i) const
+    {
+        return i < first.size() ? first[i] : second[i - first.size()];
+    }
+    iterator begin() const { return iterator(*this, 0); }
+    iterator end() const { return iterator(*this, size()); }
+};
+
+/* Pushes the first [n] bytes of bytes(), for all the commit(n) calls
+ * summed, when it goes out of scope. Not copyable nor movable. */
+template <class Ring>
+class write_guard
+{
+public:
+    explicit write_guard(Ring &r) : r_(r), seg_(r.writable_segments()) {}
+    write_guard(const write_guard &) = delete;
+    write_guard &operator=(const write_guard &) = delete;
+    ~write_guard() { if (n_) r_.push(n_); }
+
+    const segments &bytes() const { return seg_; }
+    void commit(size_t n) { n_ += n; }
+
+private:
+    Ring &r_;
+    segments seg_;
+    size_t n_ = 0;
+};
+
+/* Pops the first [n] bytes of bytes(), for all the commit(n) calls
+ * summed, when it goes out of scope. Not copyable nor movable. */
+template <class Ring>
+class read_guard
+{
+public:
+    explicit read_guard(Ring &r) : r_(r), seg_(r.readable_segments()) {}
+    read_guard(const read_guard &) = delete;
+    read_guard &operator=(const read_guard &) = delete;
+    ~read_guard() { if (n_) r_.pop(n_); }
+
+    const segments &bytes() const { return seg_; }
+    void commit(size_t n) { n_ += n; }
+
+private:
+    Ring &r_;
+    segments seg_;
+    size_t n_ = 0;
+};
+
+template <class Allocator = std::allocator<std::byte>>
+class ring
+{
+    using traits = std::allocator_traits<Allocator>;
+
+public:
+    using allocator_type = Allocator;
+
+    /* Allocates a ring of the biggest power of 2 not above [len] bytes */
+    explicit ring(size_t len, const Allocator &alloc = Allocator())
+        : alloc_(alloc), len_(std::bit_floor(len))
+    {
+        if (len_) buf_ = traits::allocate(alloc_, len_);
+        q_ = bq_make(reinterpret_cast<char *>(buf_), len_);
+    }
+
+    ring(const ring &) = delete;
+    ring &operator=(const ring &) = delete;
+
+    ring(ring &&o) noexcept
+        : alloc_(std::move(o.alloc_)), q_(o.q_),
+        buf_(std::exchange(o.buf_, nullptr)), len_(std::exchange(o.len_, 0))
+    {
+        o.q_ = bq_make(nullptr, 0);
+    }
+
+    ring &operator=(ring &&o) noexcept(
+        traits::propagate_on_container_move_assignment::value ||
+        traits::is_always_equal::value)
+    {
+        if (this == &o) return *this;
+        free_();
+        if constexpr (traits::propagate_on_container_move_assignment::value)
+            alloc_ = std::move(o.alloc_);
+
+        if (alloc_ == o.alloc_)
+        {
+            q_ = o.q_;
+            buf_ = std::exchange(o.buf_, nullptr);
+            len_ = std::exchange(o.len_, 0);
+        }
+        else
+        {
+            // Our allocator can not free the other buffer: copy it
+            len_ = o.len_;
+            buf_ = len_ ? traits::allocate(alloc_, len_) : nullptr;
+            if (len_) std::memcpy(buf_, o.buf_, len_);
+            q_ = o.q_;
+            q_.data = reinterpret_cast<char *>(buf_);
+            o.free_();
+            o.len_ = 0;
+        }
+        o.q_ = bq_make(nullptr, 0);
+        return *this;
+    }
+
+    ~ring() { free_(); }
+
+    allocator_type get_allocator() const { return alloc_; }
+    size_t capacity() const { return len_; }
+
+    /* The underlying queue, to use the C headers built on bq */
+    bq *native() { return &q_; }
+
+    /* Producer side: same as bq_pushbuf / bq_push */
+    std::span<std::byte> writable()
+    {
+        // bq_make(nullptr, 0) has mask 0, as a ring of 1 byte
+        if (!q_.data) return {};
+        size_t len;
+        void *buf = bq_pushbuf(&q_, &len);
+        return {static_cast<std::byte *>(buf), len};
+    }
+    void push(size_t count) { bq_push(&q_, count); }
+
+    /* Consumer side: same as bq_popbuf / bq_pop */
+    std::span<std::byte> readable()
+    {
+        if (!q_.data) return {};
+        size_t len;
+        void *buf = bq_popbuf(&q_, &len);
+        return {static_cast<std::byte *>(buf), len};
+    }
+    void pop(size_t count) { bq_pop(&q_, count); }
+
+    /* Producer side: all the writable bytes, on both sides of the wrap */
+    segments writable_segments()
+    {
+        if (!q_.data) return {};
+        bq_check_(&q_, producer);
+        size_t head = bq_load_(&q_.head);
+        return split_(q_.tail, q_.mask + 1 - (q_.tail - head));
+    }
+
+    /* Consumer side: all the readable bytes, on both sides of the wrap */
+    segments readable_segments()
+    {
+        if (!q_.data) return {};
+        bq_check_(&q_, consumer);
+        size_t tail = bq_load_(&q_.tail);
+        return split_(q_.head, tail - q_.head);
+    }
+
+    /* Producer side: a guard over writable_segments(), see write_guard */
+    write_guard<ring> write() { return write_guard<ring>(*this); }
+    /* Consumer side: a guard over readable_segments(), see read_guard */
+    read_guard<ring> read() { return read_guard<ring>(*this); }
+
+private:
+    segments split_(size_t from, size_t len)
+    {
+        std::byte *base = reinterpret_cast<std::byte *>(q_.data);
+        size_t off = from & q_.mask;
+        size_t first = len < q_.mask + 1 - off ? len : q_.mask + 1 - off;
+        return {{base + off, first}, {base, len - first}};
+    }
+
+    void free_()
+    {
+        if (buf_) traits::deallocate(alloc_, buf_, len_);
+        buf_ = nullptr;
+    }
+
+    [[no_unique_address]] Allocator alloc_;
+    bq q_;
+    std::byte *buf_ = nullptr;
+    size_t len_;
+};
+
+}
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BQCO_HPP
+#define BQCO_HPP
+
+/* C++20 coroutine interface of bq.hpp: a ring whose sides can wait for
+ * bytes or space with co_await. Some notable facts:
+ * 1: co_await r.readable(n) suspends the consumer coroutine until at
+ *      least [n] bytes are readable, co_await r.writable(n) the producer
+ *      coroutine until at least [n] bytes are writable. Both return the
+ *      segments of the region, to be committed with pop() / push().
+ *      [n] MUST be at most the capacity.
+ * 2: Each side has one waiter slot in the ring, holding the handle of
+ *      the suspended coroutine and the bytes it waits for. The awaitable
+ *      lives in the coroutine frame, so an await allocates nothing. The
+ *      slots are atomics, so unlike ring an async_ring is not movable.
+ * 3: push() and pop() wake the other side when it waits and its
+ *      condition holds, by passing its handle to the executor hook. The
+ *      default hook resumes it right away, inside push() / pop(): fine
+ *      for coroutines on one thread. With the two sides on different
+ *      threads the hook SHOULD hand the handle to the event loop of the
+ *      thread owning the coroutine instead.
+ * 4: A waiter publishes its slot and re-checks the ring, while the other
+ *      side publishes head or tail and then checks the slot, with a full
+ *      fence in between on both sides, so a wake up is never lost. The
+ *      slot is taken with a CAS, so exactly one of the two sides resumes
+ *      the coroutine. Without waiters a commit costs the fence and one
+ *      load more than in bq.hpp. The guards of write() / read() commit
+ *      through these push() / pop(), so they wake the other side too.
+ */
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+
+#include "bq.hpp"
+
+namespace bqpp
+{
+
+/* Resumes [h] on behalf of the ring, [ctx] is the one given with it */
+using executor = void (*)(void *ctx, std::coroutine_handle<> h);
+
+template <class Allocator = std::allocator<std::byte>>
+class async_ring : public ring<Allocator>
+{
+    using base = ring<Allocator>;
+
+    struct waiter
+    {
+        std::atomic<void *> handle{nullptr};
+        size_t want = 0;
+    };
+
+public:
+    using base::base;
+
+    /* Sets the hook resuming the woken coroutines. Not thread safe: to be
+     * called before the two sides start. */
+    void set_executor(executor fn, void *ctx)
+    {
+        exec_ = fn;
+        exec_ctx_ = ctx;
+    }
+
+    class read_awaitable;
+    class write_awaitable;
+
+    /* Consumer side: awaits [n] readable bytes */
+    read_awaitable readable(size_t n) { return read_awaitable(*this, n); }
+    /* Producer side: awaits [n] writable bytes */
+    write_awaitable writable(size_t n) { return write_awaitable(*this, n); }
+
+    using base::readable;
+    using base::writable;
+
+    /* Producer side: same as bq_push, waking the consumer if it waits */
+    void push(size_t count)
+    {
+        base::push(count);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wake_(reader_, [this](size_t n) { return readable_count_() >= n; });
+    }
+
+    /* Consumer side: same as bq_pop, waking the producer if it waits */
+    void pop(size_t count)
+    {
+        base::pop(count);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wake_(writer_, [this](size_t n) { return writable_count_() >= n; });
+    }
+
+    write_guard<async_ring> write() { return write_guard<async_ring>(*this); }
+    read_guard<async_ring> read() { return read_guard<async_ring>(*this); }
+
+private:
+    static void resume_inline_(void *, std::coroutine_handle<> h) { h.resume(); }
+
+    size_t readable_count_()
+    {
+        bq *q = this->native();
+        return bq_load_(&q->tail) - bq_load_(&q->head);
+    }
+
+    size_t writable_count_() { return this->capacity() - readable_count_(); }
+
+    /* Resumes the coroutine waiting in [w] if [ready] holds for what it
+     * waits for. want is read only once the slot is taken, as the waiter
+     * can not change it while suspended. */
+    template <class Ready>
+    void wake_(waiter &w, Ready ready)
+    {
+        void *h = w.handle.load(std::memory_order_relaxed);
+        while (h && w.handle.compare_exchange_strong(h, nullptr, std::memory_order_acq_rel))
+        {
+            if (ready(w.want))
+            {
+                exec_(exec_ctx_, std::coroutine_handle<>::from_address(h));
+                return;
+            }
+
+            // Not enough yet: put it back and check again, as the waiter
+            // does, in case the other side moved in between
+            w.handle.store(h, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!ready(w.want)) return;
+        }
+    }
+
+    /* Publishes [h] in [w], then re-checks [ready]. Returns false, with
+     * the slot taken back, if the coroutine must not suspend. */
+    template <class Ready>
+    bool suspend_(waiter &w, size_t want, std::coroutine_handle<> h, Ready ready)
+    {
+        w.want = want;
+        w.handle.store(h.address(), std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready()) return true;
+
+        // The other side could be waking us right now: whoever takes the
+        // slot back decides
+        void *expected = h.address();
+        return !w.handle.compare_exchange_strong(expected, nullptr,
+            std::memory_order_acq_rel);
+    }
+
+    alignas(64) waiter reader_;
+    alignas(64) waiter writer_;
+    executor exec_ = resume_inline_;
+    void *exec_ctx_ = nullptr;
+};
+
+template <class Allocator>
+class async_ring<Allocator>::read_awaitable
+{
+public:
+    read_awaitable(async_ring &r, size_t n) : r_(r), n_(n) { assert(n <= r.capacity()); }
+
+    bool await_ready() { return r_.readable_count_() >= n_; }
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        return r_.suspend_(r_.reader_, n_, h, [this] { return await_ready(); });
+    }
+    segments await_resume() { return r_.readable_segments(); }
+
+private:
+    async_ring &r_;
+    size_t n_;
+};
+
+template <class Allocator>
+class async_ring<Allocator>::write_awaitable
+{
+public:
+    write_awaitable(async_ring &r, size_t n) : r_(r), n_(n) { assert(n <= r.capacity()); }
+
+    bool await_ready() { return r_.writable_count_() >= n_; }
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        return r_.suspend_(r_.writer_, n_, h, [this] { return await_ready(); });
+    }
+    segments await_resume() { return r_.writable_segments(); }
+
+private:
+    async_ring &r_;
+    size_t n_;
+};
+
+}
+
+#endif
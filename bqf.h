@@ -0,0 +1,159 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BQF_H
+#define BQF_H
+
+/* stdio streams on a byte queue, with the glibc fopencookie, so that code
+ * writing to a FILE * can be a producer and code reading from a FILE *
+ * a consumer. Some notable facts:
+ * 1: stdio copies user data in its own buffer and hands it to the cookie
+ *      functions, which copy it in or out of the queue. A writer with a
+ *      buffer of size 0 is unbuffered, and fwrite of big blocks copies
+ *      straight to the queue, once. A buffer is still the best choice
+ *      for small writes, like the ones of fprintf. A reader SHOULD always
+ *      have a buffer, because glibc reads an unbuffered stream one byte
+ *      per call, but fread of blocks bigger than the buffer copies
+ *      straight from the queue anyway.
+ * 2: A flush copies the whole stdio buffer in the queue, in at most two
+ *      spans (before and after the end of the buffer). With a stdio
+ *      buffer of at most half the queue, a flush waits for the consumer
+ *      only when the queue is more than half full. BQF_BUFSIZE gives
+ *      that size, capped to BQF_MAX_BUFSIZE.
+ * 3: glibc marks a stream in error when a write returns less than asked,
+ *      so the writer waits, yielding the CPU, until everything fits. The
+ *      reader returns what is available instead, and 0 when the queue is
+ *      empty, which stdio takes as end of file: the reader calls
+ *      clearerr and reads again later. A message split by a flush, or by
+ *      a full queue, can be read in two parts.
+ * 4: The FILE * is closed with fclose, which flushes it. The queue is not
+ *      freed. A stream serves one side, as in bq.h.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/types.h>
+
+#include "bq.h"
+
+#define BQF_MAX_BUFSIZE (64*1024ull)
+#define BQF_BUFSIZE(q) \
+    (((q)->mask + 1) / 2 < BQF_MAX_BUFSIZE ? ((q)->mask + 1) / 2 : BQF_MAX_BUFSIZE)
+
+typedef struct
+{
+    bq *q;
+    char *buf;
+} bqf_cookie_;
+
+static ssize_t bqf_write_(void *cookie, const char *buf, size_t size)
+{
+    bqf_cookie_ *c = cookie;
+    for (size_t done = 0; done < size;)
+    {
+        size_t len;
+        char *dst = bq_pushbuf(c->q, &len);
+        if (!len)
+        {
+            sched_yield();
+            continue;
+        }
+
+        len = len < size - done ? len : size - done;
+        memcpy(dst, buf + done, len);
+        bq_push(c->q, len);
+        done += len;
+    }
+    return size;
+}
+
+static ssize_t bqf_read_(void *cookie, char *buf, size_t size)
+{
+    bqf_cookie_ *c = cookie;
+    size_t done = 0;
+    while (done < size)
+    {
+        size_t len;
+        char *src = bq_popbuf(c->q, &len);
+        if (!len) break;
+
+        len = len < size - done ? len : size - done;
+        memcpy(buf + done, src, len);
+        bq_pop(c->q, len);
+        done += len;
+    }
+    return done;
+}
+
+static int bqf_close_(void *cookie)
+{
+    bqf_cookie_ *c = cookie;
+    free(c->buf);
+    free(c);
+    return 0;
+}
+
+static FILE *bqf_open_(bq *q, const char *mode, cookie_io_functions_t io, size_t bufsize)
+{
+    bqf_cookie_ *c = malloc(sizeof(*c));
+    if (!c) return NULL;
+    *c = (bqf_cookie_){.q = q, .buf = bufsize ? malloc(bufsize) : NULL};
+
+    FILE *f = (bufsize && !c->buf) ? NULL : fopencookie(c, mode, io);
+    if (!f)
+    {
+        bqf_close_(c);
+        return NULL;
+    }
+
+    // glibc ignores the size when setvbuf allocates the buffer
+    if (bufsize) setvbuf(f, c->buf, _IOFBF, bufsize);
+    else setvbuf(f, NULL, _IONBF, 0);
+    return f;
+}
+
+/* Returns a stream writing to [q], with a stdio buffer of [bufsize] bytes
+ * (0 for none, see BQF_BUFSIZE), or NULL on failure */
+static FILE *bqf_open_writer(bq *q, size_t bufsize)
+{
+    return bqf_open_(q, "w", (cookie_io_functions_t){.write = bqf_write_,
+        .close = bqf_close_}, bufsize);
+}
+
+/* Returns a stream reading from [q], with a stdio buffer of [bufsize]
+ * bytes (0 for none), or NULL on failure */
+static FILE *bqf_open_reader(bq *q, size_t bufsize)
+{
+    return bqf_open_(q, "r", (cookie_io_functions_t){.read = bqf_read_,
+        .close = bqf_close_}, bufsize);
+}
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BQM_H
+#define BQM_H
+
+/* A consumer merging, in timestamp order, the records (see bqr.h) of
+ * several byte queues. Each queue has its own producer, which pushes
+ * records with non decreasing ts. Some notable facts:
+ * 1: The head record of every source sits in a binary min heap keyed on
+ *      (ts, source index), so each record costs O(log sources).
+ * 2: A record can be emitted only when every source still open has a
+ *      record: an empty source could still produce an older one. In that
+ *      case bqm_peek returns NULL and the caller retries later. A
+ *      producer with nothing to say can push an empty record to move
+ *      its ts forward, and pushes a BQR_END record when it is done.
+ * 3: Records are read in place and popped from their source in batches
+ *      of [batch] records, or as soon as the source is found empty, so
+ *      the producer is never starved of space it could reuse.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bq.h"
+#include "bqr.h"
+
+#define BQM_MAX_SOURCES 64
+
+typedef struct
+{
+    bq *src[BQM_MAX_SOURCES];
+    bqr_hdr *head[BQM_MAX_SOURCES];
+    size_t off[BQM_MAX_SOURCES];
+    unsigned uncommitted[BQM_MAX_SOURCES];
+    unsigned char queued[BQM_MAX_SOURCES];
+    unsigned char ended[BQM_MAX_SOURCES];
+    unsigned heap[BQM_MAX_SOURCES];
+    unsigned nheap, nsrc, nopen, batch;
+} bqm;
+
+static int bqm_less_(const bqm *m, unsigned a, unsigned b)
+{
+    uint64_t ta = m->head[a]->ts, tb = m->head[b]->ts;
+    return ta < tb || (ta == tb && a < b);
+}
+
+static void bqm_sift_down_(bqm *m, unsigned i)
+{
+    for (;;)
+    {
+        unsigned l = 2 * i + 1, r = l + 1, min = i;
+        if (l < m->nheap && bqm_less_(m, m->heap[l], m->heap[min])) min = l;
+        if (r < m->nheap && bqm_less_(m, m->heap[r], m->heap[min])) min = r;
+        if (min == i) return;
+        unsigned t = m->heap[i]; m->heap[i] = m->heap[min]; m->heap[min] = t;
+        i = min;
+    }
+}
+
+static void bqm_sift_up_(bqm *m, unsigned i)
+{
+    while (i && bqm_less_(m, m->heap[i], m->heap[(i - 1) / 2]))
+    {
+        unsigned p = (i - 1) / 2;
+        unsigned t = m->heap[i]; m->heap[i] = m->heap[p]; m->heap[p] = t;
+        i = p;
+    }
+}
+
+static void bqm_commit_(bqm *m, unsigned s)
+{
+    bq_pop(m->src[s], m->off[s]);
+    m->off[s] = 0;
+    m->uncommitted[s] = 0;
+}
+
+/* Looks for the head record of the source [s], which is not in the heap */
+static void bqm_fill_(bqm *m, unsigned s)
+{
+    bqr_hdr *h = bqr_peek(m->src[s], m->off + s);
+    if (!h)
+    {
+        if (m->off[s]) bqm_commit_(m, s);
+        return;
+    }
+
+    if (h->type == BQR_END)
+    {
+        m->off[s] += BQR_SIZE(h->len);
+        bqm_commit_(m, s);
+        m->ended[s] = 1;
+        m->nopen--;
+        return;
+    }
+
+    m->head[s] = h;
+    m->queued[s] = 1;
+    m->heap[m->nheap++] = s;
+    bqm_sift_up_(m, m->nheap - 1);
+}
+
+/* Initializes [m] to merge the [nsrc] byte queues [src], popping records
+ * from a source every [batch] records. [nsrc] MUST be at most
+ * BQM_MAX_SOURCES and [batch] at least 1. */
+static void bqm_init(bqm *m, bq **src, unsigned nsrc, unsigned batch)
+{
+    *m = (bqm){.nheap = 0, .nsrc = nsrc, .nopen = nsrc, .batch = batch};
+    for (unsigned i = 0; i < nsrc; i++)
+        m->src[i] = src[i];
+}
+
+/* Returns the header of the oldest record among all the sources of [m]
+ * and sets [*src] to its source, or NULL if it can not be known yet or
+ * all sources have ended (see bqm_done). The record stays valid until
+ * the next bqm_pop. */
+static bqr_hdr *bqm_peek(bqm *m, unsigned *src)
+{
+    for (unsigned s = 0; m->nheap < m->nopen && s < m->nsrc; s++)
+        if (!m->queued[s] && !m->ended[s])
+            bqm_fill_(m, s);
+
+    if (!m->nheap || m->nheap < m->nopen) return NULL;
+    *src = m->heap[0];
+    return m->head[m->heap[0]];
+}
+
+/* Pops the record returned by the last bqm_peek */
+static void bqm_pop(bqm *m)
+{
+    unsigned s = m->heap[0];
+    m->off[s] += BQR_SIZE(m->head[s]->len);
+    if (++m->uncommitted[s] >= m->batch) bqm_commit_(m, s);
+
+    m->queued[s] = 0;
+    m->heap[0] = m->heap[--m->nheap];
+    bqm_sift_down_(m, 0);
+    bqm_fill_(m, s);
+}
+
+/* Returns 1 when all the sources of [m] have ended, 0 otherwise */
+static int bqm_done(const bqm *m)
+{
+    return m->nopen == 0;
+}
+
+#endif
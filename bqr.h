@@ -0,0 +1,117 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BQR_H
+#define BQR_H
+
+/* Framed records on top of a byte queue. Some notable facts:
+ * 1: Each record is a 16 byte header followed by the payload, padded to
+ *      a multiple of 16 bytes. Since the bq length is a power of 2 (at
+ *      least 16) every record starts at a multiple of 16 and the space
+ *      between a record and the end of the buffer is always either 0 or
+ *      big enough for a header.
+ * 2: Records never wrap. When a record does not fit before the end of
+ *      the buffer the producer fills that space with a PAD record and
+ *      starts again from offset 0. The consumer skips PAD records, so a
+ *      record is always contiguous in memory and can be used in place.
+ * 3: The consumer reads records at an offset from head and commits them
+ *      with a single bq_pop of that offset, so a batch of records costs
+ *      one release store.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bq.h"
+
+#define BQR_PAD 0xffff
+#define BQR_END 0xfffe
+
+typedef struct
+{
+    uint32_t len;
+    uint16_t type;
+    uint16_t flags;
+    uint64_t ts;
+} bqr_hdr;
+
+// Size taken in the queue by a record with a payload of [len] bytes
+#define BQR_SIZE(len) (sizeof(bqr_hdr) + (((size_t)(len) + 15) & ~(size_t)15))
+
+/* Given the byte queue [q], reserves a record with a payload of [len]
+ * bytes and returns its header, or NULL if there is not enough space.
+ * The payload starts right after the header. The caller fills the
+ * other fields of the header and the payload, then calls bqr_commit. */
+static bqr_hdr *bqr_reserve(bq *q, size_t len)
+{
+    size_t size = BQR_SIZE(len), avail;
+    bqr_hdr *h = bq_pushbuf(q, &avail);
+
+    // The free space is cut by the end of the buffer: pad it only if the
+    // record fits at the start, before head
+    if (avail < size && (q->tail & q->mask) + avail == q->mask + 1 &&
+        size <= (bq_load_(&q->head) & q->mask))
+    {
+        *h = (bqr_hdr){.len = avail - sizeof(bqr_hdr), .type = BQR_PAD};
+        bq_push(q, avail);
+        h = bq_pushbuf(q, &avail);
+    }
+
+    if (avail < size) return NULL;
+    h->len = len;
+    return h;
+}
+
+/* Given the byte queue [q], commits the record [h] returned by the last
+ * bqr_reserve. The header len field MUST not be changed. */
+static void bqr_commit(bq *q, bqr_hdr *h)
+{
+    bq_push(q, BQR_SIZE(h->len));
+}
+
+/* Given the byte queue [q], returns the header of the first record after
+ * the first [*off] bytes, or NULL if there is none yet. PAD records are
+ * skipped and [*off] is advanced past them. [*off] MUST be 0 or the sum
+ * of the sizes of the records already read: the usual loop is
+ *     size_t off = 0;
+ *     for (bqr_hdr *h; (h = bqr_peek(q, &off)); off += BQR_SIZE(h->len))
+ *         ...
+ *     bq_pop(q, off);
+ */
+static bqr_hdr *bqr_peek(bq *q, size_t *off)
+{
+    size_t tail = bq_load_(&q->tail);
+
+    for (;;)
+    {
+        size_t pos = q->head + *off;
+        if (tail == pos) return NULL;
+
+        bqr_hdr *h = (bqr_hdr *)(q->data + (pos & q->mask));
+        if (h->type != BQR_PAD) return h;
+        *off += BQR_SIZE(h->len);
+    }
+}
+
+#endif
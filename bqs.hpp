@@ -0,0 +1,130 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BQS_HPP
+#define BQS_HPP
+
+/* A std::streambuf on a ring of bq.hpp, so that std::ostream writes
+ * straight in the ring and std::istream reads straight from it.
+ * Some notable facts:
+ * 1: The put area is the region returned by writable(), the get area the
+ *      one returned by readable(): the stream formats into the ring and
+ *      parses from it, with no buffer in between.
+ * 2: Written bytes are pushed by overflow(), when the put area is full,
+ *      and by sync(), i.e. on std::flush / std::endl. Read bytes are
+ *      popped by underflow(), when the get area is exhausted, and by
+ *      sync(). Bytes are then pushed and popped in batches, and the
+ *      consumer sees nothing until the producer flushes.
+ * 3: A full ring makes overflow() wait for the consumer, yielding the
+ *      CPU, because a stream can not retry a short write. An empty ring
+ *      makes underflow() return eof instead: the reader clears the state
+ *      of its istream and reads again later.
+ * 4: The put area ends at the end of the buffer, where overflow() pushes
+ *      what is written to go on from the start. So, even when messages
+ *      are flushed as a whole, the reader can find only the first part
+ *      of one and MUST be able to wait for the rest, e.g. by parsing up
+ *      to a delimiter or a length.
+ * 5: One ringbuf serves one side. The producer and the consumer thread
+ *      each use their own ringbuf on the same ring.
+ */
+
+#include <streambuf>
+#include <thread>
+
+#include "bq.hpp"
+
+namespace bqpp
+{
+
+template <class Ring = ring<>>
+class ringbuf : public std::streambuf
+{
+public:
+    explicit ringbuf(Ring &r) : r_(r) {}
+    ringbuf(const ringbuf &) = delete;
+    ringbuf &operator=(const ringbuf &) = delete;
+    ~ringbuf() override { sync(); }
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        push_();
+        std::span<std::byte> w;
+        while ((w = r_.writable()).empty())
+            std::this_thread::yield();
+
+        char *buf = reinterpret_cast<char *>(w.data());
+        setp(buf, buf + w.size());
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+        return c;
+    }
+
+    int_type underflow() override
+    {
+        pop_();
+        std::span<std::byte> rd = r_.readable();
+        char *buf = reinterpret_cast<char *>(rd.data());
+        setg(buf, buf, buf + rd.size());
+        if (rd.empty()) return traits_type::eof();
+        return traits_type::to_int_type(*gptr());
+    }
+
+    int sync() override
+    {
+        push_();
+        pop_();
+        return 0;
+    }
+
+    std::streamsize showmanyc() override
+    {
+        return r_.readable_segments().size() - (gptr() - eback());
+    }
+
+private:
+    // Pushes the bytes written in the put area, which keeps the rest
+    void push_()
+    {
+        if (pptr() == pbase()) return;
+        r_.push(pptr() - pbase());
+        setp(pptr(), epptr());
+    }
+
+    // Pops the bytes read from the get area, which keeps the rest
+    void pop_()
+    {
+        if (gptr() == eback()) return;
+        r_.pop(gptr() - eback());
+        setg(gptr(), gptr(), egptr());
+    }
+
+    Ring &r_;
+};
+
+}
+
+#endif
@@ -0,0 +1,201 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CBF_H
+#define CBF_H
+
+/* Batches of rows stored as columns, in records of a byte queue (see
+ * bqr.h), so consumers get one array per field. Some notable facts:
+ * 1: The schema is declared up front: the offset and the width (1, 2, 4
+ *      or 8 bytes) of each field in the row struct of the producer, see
+ *      CBF_FIELD, and the rows in a batch.
+ * 2: cbf_begin reserves a record big enough for a full batch, and
+ *      cbf_append copies the fields of a row in the columns, so rows are
+ *      transposed once, by the producer, as they are written. cbf_commit
+ *      pushes the batch, full or not. A partial batch is shrunk first,
+ *      moving each column right after the previous one, so only the rows
+ *      appended are pushed, at the cost of a copy.
+ * 3: Each column starts at an address aligned to CBF_ALIGN, the payload
+ *      of the record starting with the number of rows and the offset of
+ *      each column. As the record can start anywhere in the queue, the
+ *      reservation includes CBF_ALIGN - 1 bytes of slack per column.
+ * 4: cbf_read gives the consumer the column pointers of a record found
+ *      with bqr_peek, to be read in place with SIMD loads, aligned. The
+ *      record is checked against the schema of the consumer, so a column
+ *      never reaches past the end of the record.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bq.h"
+#include "bqr.h"
+
+#define CBF_TYPE        0xfffb
+#define CBF_ALIGN       64
+#define CBF_MAX_COLUMNS 16
+
+#define CBF_FIELD(type, member) {offsetof(type, member), sizeof(((type *)0)->member)}
+// The column [c] of a batch or a view, as an array of [type]
+#define CBF_COL(b, c, type) ((type *)(b)->col[c])
+
+typedef struct
+{
+    uint16_t offset;
+    uint16_t width;
+} cbf_field;
+
+typedef struct
+{
+    const cbf_field *fields;
+    unsigned n;
+    uint32_t rows;
+} cbf_schema;
+
+typedef struct
+{
+    uint32_t rows;
+    uint32_t n;
+    uint32_t off[];
+} cbf_hdr_;
+
+typedef struct
+{
+    const cbf_schema *s;
+    bqr_hdr *h;
+    uint32_t rows;
+    char *col[CBF_MAX_COLUMNS];
+} cbf_batch;
+
+typedef struct
+{
+    uint32_t rows;
+    unsigned n;
+    const char *col[CBF_MAX_COLUMNS];
+} cbf_view;
+
+// Payload size of a batch of [s], with the worst alignment
+static size_t cbf_size_(const cbf_schema *s)
+{
+    size_t size = sizeof(cbf_hdr_) + s->n * sizeof(uint32_t);
+    for (unsigned c = 0; c < s->n; c++)
+        size += CBF_ALIGN - 1 + (size_t)s->fields[c].width * s->rows;
+    return size;
+}
+
+/* Reserves in [q] an empty batch [b] of the schema [s], which MUST have
+ * at most CBF_MAX_COLUMNS fields. Returns 0 on success, -1 if [q] is
+ * full. */
+static int cbf_begin(cbf_batch *b, bq *q, const cbf_schema *s)
+{
+    bqr_hdr *h = bqr_reserve(q, cbf_size_(s));
+    if (!h) return -1;
+
+    cbf_hdr_ *p = (cbf_hdr_ *)(h + 1);
+    uintptr_t at = (uintptr_t)(p->off + s->n);
+    for (unsigned c = 0; c < s->n; c++)
+    {
+        at = (at + CBF_ALIGN - 1) & ~(uintptr_t)(CBF_ALIGN - 1);
+        p->off[c] = at - (uintptr_t)p;
+        b->col[c] = (char *)at;
+        at += (size_t)s->fields[c].width * s->rows;
+    }
+    p->n = s->n;
+    b->s = s;
+    b->h = h;
+    b->rows = 0;
+    return 0;
+}
+
+/* Appends the fields of [row] to the batch [b]. Returns 0 on success, -1
+ * if [b] is full. */
+static int cbf_append(cbf_batch *b, const void *row)
+{
+    if (b->rows == b->s->rows) return -1;
+    const char *r = row;
+    for (unsigned c = 0; c < b->s->n; c++)
+    {
+        const cbf_field *f = b->s->fields + c;
+        char *dst = b->col[c] + (size_t)b->rows * f->width;
+        switch (f->width)
+        {
+        case 1: *dst = r[f->offset]; break;
+        case 2: memcpy(dst, r + f->offset, 2); break;
+        case 4: memcpy(dst, r + f->offset, 4); break;
+        default: memcpy(dst, r + f->offset, 8); break;
+        }
+    }
+    b->rows++;
+    return 0;
+}
+
+/* Pushes the batch [b], reserved on [q] by the last cbf_begin */
+static void cbf_commit(bq *q, cbf_batch *b)
+{
+    cbf_hdr_ *p = (cbf_hdr_ *)(b->h + 1);
+    uintptr_t at = (uintptr_t)(p->off + b->s->n);
+    for (unsigned c = 0; c < b->s->n; c++)
+    {
+        // Columns only move back, into the rows missing before them
+        at = (at + CBF_ALIGN - 1) & ~(uintptr_t)(CBF_ALIGN - 1);
+        size_t size = (size_t)b->s->fields[c].width * b->rows;
+        if ((char *)at != b->col[c])
+        {
+            memmove((char *)at, b->col[c], size);
+            p->off[c] = at - (uintptr_t)p;
+            b->col[c] = (char *)at;
+        }
+        at += size;
+    }
+
+    b->h->len = at - (uintptr_t)p;
+    b->h->type = CBF_TYPE;
+    b->h->flags = 0;
+    p->rows = b->rows;
+    bqr_commit(q, b->h);
+}
+
+/* Fills [v] with the columns of the batch [h], found with bqr_peek.
+ * Returns 0 on success, -1 if [h] is not a batch of the schema [s]. */
+static int cbf_read(const bqr_hdr *h, const cbf_schema *s, cbf_view *v)
+{
+    const cbf_hdr_ *p = (const cbf_hdr_ *)(h + 1);
+    unsigned n = s->n;
+    if (h->type != CBF_TYPE || n > CBF_MAX_COLUMNS ||
+        h->len < sizeof(*p) + n * sizeof(uint32_t) || p->n != n ||
+        p->rows > s->rows)
+        return -1;
+
+    v->rows = p->rows;
+    v->n = n;
+    for (unsigned c = 0; c < n; c++)
+    {
+        if (p->off[c] + (size_t)p->rows * s->fields[c].width > h->len) return -1;
+        v->col[c] = (const char *)p + p->off[c];
+    }
+    return 0;
+}
+
+#endif
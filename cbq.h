@@ -0,0 +1,138 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CBQ_H
+#define CBQ_H
+
+/* A compact variant of the byte queue in bq.h, meant for programs that
+ * hold a very large number of small queues (e.g. one per connection).
+ * The algorithm is exactly the one of bq.h, only the representation
+ * changes:
+ * 1: head and tail are 32 bit counters. Everything said in bq.h about
+ *      the implicit (mod SIZE_MAX+1) still holds with (mod UINT32_MAX+1):
+ *      a power of 2 capacity divides 2^32, so head == tail still means
+ *      empty and (tail - head) == capacity still means full, even after
+ *      the counters wrap around UINT32_MAX. For (tail - head) to be able
+ *      to represent a full queue the capacity is limited to 2^31 bytes.
+ * 2: The mask is not stored. The geometry is packed in a single field
+ *      holding cap_lg2 and the mask is recomputed with a shift, which
+ *      costs less than the cache line it would otherwise take.
+ * 3: The buffer is stored inline, right after the descriptor, so that a
+ *      queue is a single allocation of CBQ_SIZE(capacity) bytes. With
+ *      capacities between 256 B and 4 KiB a queue spans a handful of
+ *      cache lines and there is no pointer to chase to reach the data.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CBQ_MAX_LG2 31
+
+typedef struct
+{
+    uint32_t head, tail;
+    // Bits 0-7: cap_lg2. Bits 8-31: reserved, always 0.
+    uint32_t geom;
+    uint32_t reserved;
+    _Alignas(16) char data[];
+} cbq;
+
+/* Number of bytes needed to hold a compact byte queue of [cap] bytes */
+#define CBQ_SIZE(cap) (sizeof(cbq) + (cap))
+
+#define cbq_lg2_(q) ((q)->geom & 0xff)
+#define cbq_mask_(q) ((uint32_t)((1ULL << cbq_lg2_(q)) - 1))
+
+/* Returns a compact byte queue built inside the memory [mem] of size
+ * [len], or NULL if [len] cannot hold even a single byte queue of 1 B.
+ * The descriptor is placed at the start of [mem] and the data buffer
+ * takes the biggest power of two that fits in the remaining space,
+ * up to 2^CBQ_MAX_LG2 bytes. [mem] MUST be aligned to 16 bytes
+ * (anything returned by malloc is). */
+static cbq *cbq_make(void *mem, size_t len)
+{
+    if (!mem || len <= sizeof(cbq)) return NULL;
+
+    len -= sizeof(cbq);
+    if (len >> CBQ_MAX_LG2) len = 1UL << CBQ_MAX_LG2;
+
+    // Calculates the position of the msb setted in len
+    uint32_t l = len;
+    unsigned char msb = 0;
+    if (l >> 16) { l >>= 16; msb += 16; }
+    if (l >> 8)  { l >>= 8;  msb += 8;  }
+    if (l >> 4)  { l >>= 4;  msb += 4;  }
+    if (l >> 2)  { l >>= 2;  msb += 2;  }
+    if (l >> 1)  {           msb += 1;  }
+
+    cbq *q = mem;
+    *q = (cbq){.head = 0, .tail = 0, .geom = msb};
+    return q;
+}
+
+/* Given the compact byte queue [q], returns a pointer to the buffer of
+ * poppable bytes and sets [*len] to the len of the buffer.
+ * See bq_popbuf for the details. */
+static void *cbq_popbuf(cbq *q, size_t *len)
+{
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    uint32_t lg2 = cbq_lg2_(q), mask = cbq_mask_(q);
+    // Same as in bq_popbuf: 0 or 1 once reduced by the bitwise AND,
+    // also when tail has wrapped around UINT32_MAX.
+    uint32_t cond = ((tail >> lg2) - (q->head >> lg2)) & 0x1;
+    *len = (uint32_t)(tail - q->head - (tail & mask) * cond);
+
+    return q->data + (q->head & mask);
+}
+
+/* Given the compact byte queue [q], pops [count] bytes from it.
+ * See bq_pop for the details. */
+static void cbq_pop(cbq *q, size_t count)
+{
+    __atomic_store_n(&q->head, q->head + (uint32_t)count, __ATOMIC_RELEASE);
+}
+
+/* Given the compact byte queue [q], returns a pointer to the buffer of
+ * pushable bytes and sets [*len] to the len of the buffer.
+ * See bq_pushbuf for the details. */
+static void *cbq_pushbuf(cbq *q, size_t *len)
+{
+    uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    uint32_t lg2 = cbq_lg2_(q), mask = cbq_mask_(q);
+    uint32_t cond = ((q->tail >> lg2) - (head >> lg2)) & 0x1;
+    // mask + 1 is computed as a 32 bit value, so the whole expression
+    // is reduced (mod UINT32_MAX+1) like the counters are.
+    *len = (uint32_t)(mask + 1 - (q->tail - head) - (head & mask) * (1 - cond));
+
+    return q->data + (q->tail & mask);
+}
+
+/* Given the compact byte queue [q], push [count] bytes to it.
+ * See bq_push for the details. */
+static void cbq_push(cbq *q, size_t count)
+{
+    __atomic_store_n(&q->tail, q->tail + (uint32_t)count, __ATOMIC_RELEASE);
+}
+
+#endif
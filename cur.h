@@ -0,0 +1,238 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CUR_H
+#define CUR_H
+
+/* Cursors reading and writing fields straight in a byte queue, across
+ * the end of the buffer. Some notable facts:
+ * 1: A cursor takes a snapshot of the queue: from head to tail for a
+ *      reader, from tail to head plus the capacity for a writer. Fields
+ *      are read or written at its position, and cur_pop or cur_push
+ *      commits everything up to it in one step.
+ * 2: The cursor also keeps the end of the contiguous span it is in. When
+ *      a field fits in it, the fast path is one compare and a memcpy of
+ *      a constant size. Otherwise the slow path copies the field in two
+ *      parts, around the end of the buffer.
+ * 3: A field that does not fit in the snapshot returns CUR_MORE and
+ *      leaves the position as it was. To parse messages that can be
+ *      incomplete, save the position before each one with cur_mark, and
+ *      on CUR_MORE go back to it with cur_rewind, commit the messages
+ *      before it and take a new snapshot later, when there is more data.
+ *      A reader can commit a partial message as well, a writer too, as
+ *      long as it never rewinds before what it committed.
+ * 4: Integers are in the byte order of the machine. Varints are LEB128,
+ *      at most 10 bytes: a longer one returns CUR_BAD.
+ * 5: A cursor serves one side, as in bq.h. Taking a new snapshot drops
+ *      what was read or written and not committed.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bq.h"
+
+#define CUR_MORE    -1
+#define CUR_BAD     -2
+#define CUR_VARINT  10
+
+typedef struct
+{
+    bq *q;
+    size_t start, pos, lim, end;
+} cur;
+
+static void cur_span_(cur *c)
+{
+    size_t wrap = (c->pos & ~c->q->mask) + c->q->mask + 1;
+    c->lim = (ptrdiff_t)(wrap - c->end) < 0 ? wrap : c->end;
+}
+
+/* Makes [c] a reader of everything pushed to [q] */
+static void cur_reader(cur *c, bq *q)
+{
+    bq_check_(q, consumer);
+    c->q = q;
+    c->start = c->pos = q->head;
+    c->end = bq_load_(&q->tail);
+    cur_span_(c);
+}
+
+/* Makes [c] a writer of all the free space of [q] */
+static void cur_writer(cur *c, bq *q)
+{
+    bq_check_(q, producer);
+    c->q = q;
+    c->start = c->pos = q->tail;
+    c->end = bq_load_(&q->head) + q->mask + 1;
+    cur_span_(c);
+}
+
+/* The position of [c], to go back to with cur_rewind */
+static size_t cur_mark(const cur *c)
+{
+    return c->pos;
+}
+
+static void cur_rewind(cur *c, size_t mark)
+{
+    c->pos = mark;
+    cur_span_(c);
+}
+
+/* Bytes left in the snapshot of [c] */
+static size_t cur_left(const cur *c)
+{
+    return c->end - c->pos;
+}
+
+/* Reader side: pops everything before the position of [c] */
+static void cur_pop(cur *c)
+{
+    bq_pop(c->q, c->pos - c->start);
+    c->start = c->pos;
+}
+
+/* Writer side: pushes everything before the position of [c] */
+static void cur_push(cur *c)
+{
+    bq_push(c->q, c->pos - c->start);
+    c->start = c->pos;
+}
+
+static int cur_get_slow_(cur *c, void *v, size_t n)
+{
+    if (c->end - c->pos < n) return CUR_MORE;
+    size_t off = c->pos & c->q->mask, first = c->q->mask + 1 - off;
+    first = first < n ? first : n;
+    memcpy(v, c->q->data + off, first);
+    memcpy((char *)v + first, c->q->data, n - first);
+    c->pos += n;
+    cur_span_(c);
+    return 0;
+}
+
+static int cur_put_slow_(cur *c, const void *v, size_t n)
+{
+    if (c->end - c->pos < n) return CUR_MORE;
+    size_t off = c->pos & c->q->mask, first = c->q->mask + 1 - off;
+    first = first < n ? first : n;
+    memcpy(c->q->data + off, v, first);
+    memcpy(c->q->data, (const char *)v + first, n - first);
+    c->pos += n;
+    cur_span_(c);
+    return 0;
+}
+
+/* Reads [n] bytes to [v]. Returns 0 or CUR_MORE. */
+static inline int cur_get_bytes(cur *c, void *v, size_t n)
+{
+    if (c->lim - c->pos <= n) return cur_get_slow_(c, v, n);
+    memcpy(v, c->q->data + (c->pos & c->q->mask), n);
+    c->pos += n;
+    return 0;
+}
+
+/* Writes the [n] bytes of [v]. Returns 0 or CUR_MORE. */
+static inline int cur_put_bytes(cur *c, const void *v, size_t n)
+{
+    if (c->lim - c->pos <= n) return cur_put_slow_(c, v, n);
+    memcpy(c->q->data + (c->pos & c->q->mask), v, n);
+    c->pos += n;
+    return 0;
+}
+
+/* Returns the [n] bytes at the position of [c], in place, and moves past
+ * them, or NULL if they are not all contiguous, left for cur_get_bytes */
+static const void *cur_get_view(cur *c, size_t n)
+{
+    if (c->lim - c->pos < n) return NULL;
+    const void *p = c->q->data + (c->pos & c->q->mask);
+    c->pos += n;
+    if (c->pos == c->lim) cur_span_(c);
+    return p;
+}
+
+static inline int cur_get_u8(cur *c, uint8_t *v) { return cur_get_bytes(c, v, sizeof(*v)); }
+static inline int cur_get_u16(cur *c, uint16_t *v) { return cur_get_bytes(c, v, sizeof(*v)); }
+static inline int cur_get_u32(cur *c, uint32_t *v) { return cur_get_bytes(c, v, sizeof(*v)); }
+static inline int cur_get_u64(cur *c, uint64_t *v) { return cur_get_bytes(c, v, sizeof(*v)); }
+static inline int cur_put_u8(cur *c, uint8_t v) { return cur_put_bytes(c, &v, sizeof(v)); }
+static inline int cur_put_u16(cur *c, uint16_t v) { return cur_put_bytes(c, &v, sizeof(v)); }
+static inline int cur_put_u32(cur *c, uint32_t v) { return cur_put_bytes(c, &v, sizeof(v)); }
+static inline int cur_put_u64(cur *c, uint64_t v) { return cur_put_bytes(c, &v, sizeof(v)); }
+
+/* Reads a varint to [v]. Returns 0, CUR_MORE or CUR_BAD. */
+static int cur_get_varint(cur *c, uint64_t *v)
+{
+    uint64_t x = 0;
+    if (c->lim - c->pos > CUR_VARINT)
+    {
+        const uint8_t *p = (const uint8_t *)c->q->data + (c->pos & c->q->mask);
+        for (unsigned i = 0; i < CUR_VARINT; i++)
+        {
+            x |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+            if (p[i] < 0x80)
+            {
+                c->pos += i + 1;
+                *v = x;
+                return 0;
+            }
+        }
+        return CUR_BAD;
+    }
+
+    size_t mark = c->pos;
+    for (unsigned i = 0; i < CUR_VARINT; i++)
+    {
+        uint8_t b;
+        if (cur_get_slow_(c, &b, 1))
+        {
+            cur_rewind(c, mark);
+            return CUR_MORE;
+        }
+        x |= (uint64_t)(b & 0x7f) << (7 * i);
+        if (b < 0x80)
+        {
+            *v = x;
+            return 0;
+        }
+    }
+    cur_rewind(c, mark);
+    return CUR_BAD;
+}
+
+/* Writes [v] as a varint. Returns 0 or CUR_MORE. */
+static int cur_put_varint(cur *c, uint64_t v)
+{
+    uint8_t buf[CUR_VARINT];
+    size_t n = 0;
+    for (; v >= 0x80; v >>= 7)
+        buf[n++] = v | 0x80;
+    buf[n++] = v;
+    return cur_put_bytes(c, buf, n);
+}
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DLQ_H
+#define DLQ_H
+
+/* A queue of records (see bqr.h) with a deadline, where the consumer can
+ * drop all the expired records in one step. Some notable facts:
+ * 1: Next to the data bq there is an index bq of 16 byte descriptors,
+ *      one per record: its deadline and the data tail right after it.
+ *      The producer commits the record first and the descriptor after,
+ *      so a descriptor always refers to a complete record.
+ * 2: Deadlines MUST be non decreasing, as they are when every record gets
+ *      its enqueue time plus a fixed time to live. The expired records
+ *      are then a prefix of the index, found with a binary search, and
+ *      dropped with one bq_pop on each queue. Payloads are never read.
+ * 3: The deadline is also stored in the ts field of the record header.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bq.h"
+#include "bqr.h"
+
+typedef struct
+{
+    uint64_t deadline;
+    uint64_t end;
+} dlq_desc;
+
+typedef struct
+{
+    bq data, index;
+    // Consumer private counters
+    uint64_t dropped, dropped_bytes;
+} dlq;
+
+/* Initializes [d] with the buffer [data] of size [data_len] for the
+ * records and the buffer [index] of size [index_len] for the
+ * descriptors. Lengths SHOULD be powers of 2, see bq_make. */
+static void dlq_init(dlq *d, char *data, size_t data_len, char *index, size_t index_len)
+{
+    *d = (dlq){.data = bq_make(data, data_len), .index = bq_make(index, index_len)};
+}
+
+/* Producer side: reserves a record with a payload of [len] bytes and
+ * returns its header, or NULL if there is not enough space */
+static bqr_hdr *dlq_reserve(dlq *d, size_t len)
+{
+    size_t avail;
+    bq_pushbuf(&d->index, &avail);
+    if (avail < sizeof(dlq_desc)) return NULL;
+    return bqr_reserve(&d->data, len);
+}
+
+/* Producer side: commits the record [h], returned by the last
+ * dlq_reserve, with the deadline [deadline] */
+static void dlq_commit(dlq *d, bqr_hdr *h, uint64_t deadline)
+{
+    size_t avail;
+    h->ts = deadline;
+    bqr_commit(&d->data, h);
+
+    dlq_desc *desc = bq_pushbuf(&d->index, &avail);
+    *desc = (dlq_desc){.deadline = deadline, .end = d->data.tail};
+    bq_push(&d->index, sizeof(*desc));
+}
+
+static dlq_desc *dlq_desc_(dlq *d, size_t i)
+{
+    return (dlq_desc *)(d->index.data +
+        ((d->index.head + i * sizeof(dlq_desc)) & d->index.mask));
+}
+
+/* Consumer side: drops all the records with a deadline before [now].
+ * Returns the number of dropped records. */
+static size_t dlq_drop_expired(dlq *d, uint64_t now)
+{
+    size_t n = (bq_load_(&d->index.tail) - d->index.head) / sizeof(dlq_desc);
+
+    // First descriptor with a deadline not before now
+    size_t lo = 0, hi = n;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (dlq_desc_(d, mid)->deadline < now) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if (!lo) return 0;
+    size_t bytes = dlq_desc_(d, lo - 1)->end - d->data.head;
+    bq_pop(&d->data, bytes);
+    bq_pop(&d->index, lo * sizeof(dlq_desc));
+    d->dropped += lo;
+    d->dropped_bytes += bytes;
+    return lo;
+}
+
+/* Consumer side: returns the header of the next record, or NULL if there
+ * is none */
+static bqr_hdr *dlq_peek(dlq *d)
+{
+    if (bq_load_(&d->index.tail) == d->index.head) return NULL;
+    size_t off = 0;
+    return bqr_peek(&d->data, &off);
+}
+
+/* Consumer side: pops the record returned by the last dlq_peek */
+static void dlq_pop(dlq *d)
+{
+    bq_pop(&d->data, dlq_desc_(d, 0)->end - d->data.head);
+    bq_pop(&d->index, sizeof(dlq_desc));
+}
+
+#endif
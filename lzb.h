@@ -0,0 +1,332 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LZB_H
+#define LZB_H
+
+/* An LZ block compressor, with no dependencies, and a pipeline stage
+ * compressing the records (see bqr.h) of one byte queue into another.
+ * Some notable facts:
+ * 1: The format is a sequence of tokens, as in LZ4: the high nibble of a
+ *      token is the number of literals following it, the low nibble the
+ *      match length minus 4, then the 2 byte offset of the match. A
+ *      nibble of 15 continues in the bytes after it, each added up to
+ *      the first one below 255. The last token has only literals.
+ * 2: Matches are found with a hash table of the last position of each 4
+ *      byte prefix, and extended 16 bytes at a time with SSE2 compares.
+ *      After 64 misses in a row the compressor skips ahead faster, so
+ *      data that does not compress costs little.
+ * 3: lzb_compress returns 0 when the output does not fit in [cap] bytes:
+ *      with [cap] equal to the input length, incompressible blocks are
+ *      detected and can be stored as they are. lzb_decompress checks all
+ *      its reads and writes, corrupted input can not overflow.
+ * 4: lzb_pack takes a run of contiguous records from the head of [in],
+ *      up to LZB_MAX_BLOCK bytes, and compresses them straight from the
+ *      queue into one LZB_TYPE record of [out], with the raw length in
+ *      the first 8 bytes of the payload and the ts of the first record.
+ *      Blocks that do not compress are stored with the LZB_STORED flag.
+ *      lzb_unpack decompresses straight into [out] the records as they
+ *      were. No copies on either side.
+ * 5: The payload of a packed record is at most the raw length plus 8, so
+ *      [out] of lzb_pack MUST fit a record of LZB_MAX_BLOCK + 8 bytes, and
+ *      [out] of lzb_unpack a record of LZB_MAX_BLOCK. A record of [in]
+ *      bigger than LZB_MAX_BLOCK is packed alone and needs more.
+ * 6: For buffers going to a file or a socket, lzb_compress and
+ *      lzb_decompress work on any memory, the lzb context holding only
+ *      the hash table.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <emmintrin.h>
+
+#include "bq.h"
+#include "bqr.h"
+
+#define LZB_HASH_BITS   12
+#define LZB_MIN_MATCH   4
+#define LZB_MAX_OFFSET  65535
+#define LZB_MAX_BLOCK   (64*1024)
+#define LZB_TYPE        0xfffd
+#define LZB_STORED      1
+
+typedef struct
+{
+    uint32_t table[1 << LZB_HASH_BITS];
+} lzb;
+
+static uint32_t lzb_read32_(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lzb_hash_(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZB_HASH_BITS);
+}
+
+// Length of the common prefix of [a] and [b], with [a] before [b]
+static size_t lzb_match_(const uint8_t *a, const uint8_t *b, const uint8_t *end)
+{
+    const uint8_t *start = b;
+    for (; b + 16 <= end; a += 16, b += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)a);
+        __m128i y = _mm_loadu_si128((const __m128i *)b);
+        unsigned diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xffff;
+        if (diff) return b - start + __builtin_ctz(diff);
+    }
+    while (b < end && *a == *b) a++, b++;
+    return b - start;
+}
+
+static uint8_t *lzb_putlen_(uint8_t *op, uint8_t *oend, size_t len)
+{
+    for (; len >= 255; len -= 255)
+    {
+        if (op == oend) return NULL;
+        *op++ = 255;
+    }
+    if (op == oend) return NULL;
+    *op++ = len;
+    return op;
+}
+
+static int lzb_getlen_(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+    unsigned b;
+    do
+    {
+        if (*ip == iend) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+// Writes a token, with no match if [mlen] is 0. Returns NULL if it does
+// not fit.
+static uint8_t *lzb_token_(uint8_t *op, uint8_t *oend, const uint8_t *lit,
+    size_t nlit, size_t off, size_t mlen)
+{
+    if (op == oend) return NULL;
+    uint8_t *token = op++;
+    size_t m = mlen ? mlen - LZB_MIN_MATCH : 0;
+    *token = (nlit < 15 ? nlit : 15) << 4 | (m < 15 ? m : 15);
+    if (nlit >= 15 && !(op = lzb_putlen_(op, oend, nlit - 15))) return NULL;
+    if ((size_t)(oend - op) < nlit) return NULL;
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (!mlen) return op;
+
+    if (oend - op < 2) return NULL;
+    op[0] = off;
+    op[1] = off >> 8;
+    op += 2;
+    if (m >= 15 && !(op = lzb_putlen_(op, oend, m - 15))) return NULL;
+    return op;
+}
+
+/* Compresses the [len] bytes of [src] to [dst], using the context [z].
+ * Returns the compressed size, or 0 if it does not fit in [cap] bytes.
+ * [len] MUST be below 4 GB. */
+static size_t lzb_compress(lzb *z, void *dst, size_t cap, const void *src, size_t len)
+{
+    const uint8_t *base = src, *ip = base, *anchor = base, *iend = base + len;
+    uint8_t *op = dst, *oend = op + cap;
+    memset(z->table, 0, sizeof(z->table));
+
+    for (unsigned misses = 0; ip + LZB_MIN_MATCH <= iend;)
+    {
+        uint32_t v = lzb_read32_(ip);
+        uint32_t *slot = z->table + lzb_hash_(v);
+        const uint8_t *cand = base + *slot;
+        *slot = ip - base;
+        if (cand >= ip || ip - cand > LZB_MAX_OFFSET || lzb_read32_(cand) != v)
+        {
+            ip += 1 + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+
+        // The match can start before, among the literals
+        while (ip > anchor && cand > base && ip[-1] == cand[-1])
+            ip--, cand--;
+
+        size_t mlen = LZB_MIN_MATCH + lzb_match_(cand + LZB_MIN_MATCH, ip + LZB_MIN_MATCH, iend);
+        op = lzb_token_(op, oend, anchor, ip - anchor, ip - cand, mlen);
+        if (!op) return 0;
+        ip += mlen;
+        anchor = ip;
+
+        // Also index the end of the match, repeated data often follows
+        if (ip - 2 >= base && ip + 2 <= iend)
+            z->table[lzb_hash_(lzb_read32_(ip - 2))] = ip - 2 - base;
+    }
+
+    op = lzb_token_(op, oend, anchor, iend - anchor, 0, 0);
+    return op ? op - (uint8_t *)dst : 0;
+}
+
+/* Decompresses the [size] bytes of [src] to the [len] bytes of [dst].
+ * Returns 0 on success, -1 if [src] is corrupted or does not decompress
+ * to exactly [len] bytes. */
+static int lzb_decompress(void *dst, size_t len, const void *src, size_t size)
+{
+    const uint8_t *ip = src, *iend = ip + size;
+    uint8_t *op = dst, *oend = op + len;
+
+    for (;;)
+    {
+        if (ip == iend) return -1;
+        unsigned token = *ip++;
+        size_t nlit = token >> 4;
+        if (nlit == 15 && lzb_getlen_(&ip, iend, &nlit)) return -1;
+        if ((size_t)(iend - ip) < nlit || (size_t)(oend - op) < nlit) return -1;
+        if (nlit <= 16 && iend - ip >= 16 && oend - op >= 16)
+            _mm_storeu_si128((__m128i *)op, _mm_loadu_si128((const __m128i *)ip));
+        else memcpy(op, ip, nlit);
+        op += nlit;
+        ip += nlit;
+        if (ip == iend) return op == oend ? 0 : -1;
+
+        if (iend - ip < 2) return -1;
+        size_t off = ip[0] | ip[1] << 8;
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15 && lzb_getlen_(&ip, iend, &mlen)) return -1;
+        mlen += LZB_MIN_MATCH;
+        if (!off || off > (size_t)(op - (uint8_t *)dst) || (size_t)(oend - op) < mlen)
+            return -1;
+
+        const uint8_t *m = op - off;
+        if (off >= 16 && (size_t)(oend - op) >= mlen + 15)
+        {
+            // Each 16 bytes are already written before they are read
+            for (size_t i = 0; i < mlen; i += 16)
+                _mm_storeu_si128((__m128i *)(op + i), _mm_loadu_si128((const __m128i *)(m + i)));
+        }
+        else
+        {
+            for (size_t i = 0; i < mlen; i++)
+                op[i] = m[i];
+        }
+        op += mlen;
+    }
+}
+
+/* Compresses records from the head of [in] into one record of [out],
+ * using the context [z], and pops them. Returns the bytes taken from
+ * [in], 0 if it is empty or [out] is full. */
+static size_t lzb_pack(lzb *z, bq *in, bq *out)
+{
+    size_t start = 0;
+    bqr_hdr *first = bqr_peek(in, &start);
+    if (!first) return 0;
+
+    // Records never wrap, but the run stops at a PAD record or at the end
+    // of the buffer
+    size_t end = start;
+    for (bqr_hdr *h = first; h;)
+    {
+        size_t size = BQR_SIZE(h->len);
+        if (end != start && end - start + size > LZB_MAX_BLOCK) break;
+        end += size;
+        size_t next = end;
+        if (!((in->head + end) & in->mask)) break;
+        h = bqr_peek(in, &next);
+        if (h && next != end) break;
+    }
+
+    uint64_t raw = end - start;
+    bqr_hdr *h = bqr_reserve(out, sizeof(raw) + raw);
+    if (!h) return 0;
+
+    const char *src = in->data + ((in->head + start) & in->mask);
+    char *dst = (char *)(h + 1) + sizeof(raw);
+    size_t size = lzb_compress(z, dst, raw, src, raw);
+    h->flags = 0;
+    if (!size)
+    {
+        memcpy(dst, src, raw);
+        size = raw;
+        h->flags = LZB_STORED;
+    }
+
+    // Shrinking the reservation is safe, nothing was pushed after it
+    memcpy(h + 1, &raw, sizeof(raw));
+    h->len = sizeof(raw) + size;
+    h->type = LZB_TYPE;
+    h->ts = first->ts;
+    bqr_commit(out, h);
+    bq_pop(in, end);
+    return raw;
+}
+
+// Pops the corrupted record [h], at [off] in [in], so the next call goes on
+static ptrdiff_t lzb_drop_(bq *in, size_t off, const bqr_hdr *h)
+{
+    size_t used = bq_load_(&in->tail) - in->head;
+    size_t size = off + BQR_SIZE(h->len);
+    bq_pop(in, size < used ? size : used);
+    return -1;
+}
+
+/* Decompresses the record at the head of [in], written by lzb_pack, into
+ * the records it holds in [out], and pops it. Returns the bytes pushed to
+ * [out], 0 if [in] is empty or [out] is full, -1 if the record is
+ * corrupted, in which case it is popped and nothing is pushed. [in] MUST
+ * only hold records written by lzb_pack. */
+static ptrdiff_t lzb_unpack(bq *in, bq *out)
+{
+    size_t off = 0;
+    bqr_hdr *h = bqr_peek(in, &off);
+    if (!h) return 0;
+
+    uint64_t raw;
+    if (h->type != LZB_TYPE || h->len < sizeof(raw)) return lzb_drop_(in, off, h);
+    memcpy(&raw, h + 1, sizeof(raw));
+    if (raw < sizeof(bqr_hdr) || raw % 16 || raw > out->mask + 1) return lzb_drop_(in, off, h);
+
+    bqr_hdr *r = bqr_reserve(out, raw - sizeof(bqr_hdr));
+    if (!r) return 0;
+
+    const char *src = (const char *)(h + 1) + sizeof(raw);
+    size_t size = h->len - sizeof(raw);
+    if (h->flags & LZB_STORED)
+    {
+        if (size != raw) return lzb_drop_(in, off, h);
+        memcpy(r, src, raw);
+    }
+    else if (lzb_decompress(r, raw, src, size)) return lzb_drop_(in, off, h);
+
+    bq_push(out, raw);
+    bq_pop(in, off + BQR_SIZE(h->len));
+    return raw;
+}
+
+#endif
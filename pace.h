@@ -0,0 +1,176 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PACE_H
+#define PACE_H
+
+/* A token bucket limiting the bytes per second and the burst of one side
+ * of a byte queue. Some notable facts:
+ * 1: Time is measured with the TSC, so checking the bucket costs an
+ *      rdtsc and not a clock_gettime. The TSC frequency is calibrated
+ *      against CLOCK_MONOTONIC once per process. The TSC is assumed to
+ *      be invariant, as it is on any x86_64 of the last decade.
+ * 2: The bucket is stored as a single value, the TSC at which it will be
+ *      full again (tat), as in the generic cell rate algorithm. The bytes
+ *      available at [now] are (now - tat) / ticks_per_byte plus the burst,
+ *      and spending n bytes moves tat forward by n * ticks_per_byte.
+ *      ticks_per_byte is a 16.16 fixed point number.
+ * 3: The paced side calls pace_pushbuf / pace_popbuf instead of the bq
+ *      ones, which clamp the len to the bytes the bucket allows, and
+ *      pace_push / pace_pop, which also spend them. When nothing is
+ *      allowed, pace_wait sleeps until enough bytes are: with the kernel
+ *      for most of the time, then spinning on the TSC for the last
+ *      PACE_SPIN_NS, to wake up on time without burning a core.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <x86intrin.h>
+
+#include "bq.h"
+
+#define PACE_SPIN_NS        50000ull
+#define PACE_CALIBRATE_NS   10000000ull
+
+typedef struct
+{
+    uint64_t tat;
+    uint64_t ticks_per_byte;
+    uint64_t burst_ticks;
+    uint64_t burst;
+    double ticks_per_ns;
+} pace;
+
+static uint64_t pace_now_ns_(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Returns the number of TSC ticks per nanosecond, calibrated on the
+ * first call */
+static double pace_tsc_per_ns(void)
+{
+    static double ticks_per_ns;
+    if (ticks_per_ns) return ticks_per_ns;
+
+    uint64_t ns0 = pace_now_ns_(), tsc0 = __rdtsc(), ns1;
+    while ((ns1 = pace_now_ns_()) - ns0 < PACE_CALIBRATE_NS);
+    uint64_t tsc1 = __rdtsc();
+
+    ticks_per_ns = (double)(tsc1 - tsc0) / (ns1 - ns0);
+    return ticks_per_ns;
+}
+
+/* Initializes [p] to allow [rate] bytes per second with bursts of at most
+ * [burst] bytes. The bucket starts full. */
+static void pace_init(pace *p, uint64_t rate, uint64_t burst)
+{
+    double ticks_per_ns = pace_tsc_per_ns();
+    uint64_t tpb = ticks_per_ns * 1e9 * 65536 / rate;
+    *p = (pace){.ticks_per_byte = tpb ? tpb : 1, .burst = burst,
+        .ticks_per_ns = ticks_per_ns};
+    p->burst_ticks = ((unsigned __int128)burst * p->ticks_per_byte) >> 16;
+    p->tat = __rdtsc();
+}
+
+/* Returns the number of bytes [p] allows to move right now */
+static size_t pace_avail(const pace *p)
+{
+    // tat is in the future once the bucket is not full: signed difference
+    int64_t credit = (int64_t)(__rdtsc() - p->tat) + (int64_t)p->burst_ticks;
+    if (credit <= 0) return 0;
+
+    uint64_t bytes = ((unsigned __int128)credit << 16) / p->ticks_per_byte;
+    return bytes < p->burst ? bytes : p->burst;
+}
+
+/* Spends [count] bytes from [p]. [count] MUST be at most the value
+ * returned by the last pace_avail. */
+static void pace_spend(pace *p, size_t count)
+{
+    uint64_t now = __rdtsc();
+    // A bucket full since a long time must not give more than burst
+    if ((int64_t)(now - p->tat) > 0) p->tat = now;
+    p->tat += ((unsigned __int128)count * p->ticks_per_byte) >> 16;
+}
+
+/* Waits until [p] allows to move [count] bytes. [count] MUST be at most
+ * the burst of [p]. */
+static void pace_wait(const pace *p, size_t count)
+{
+    uint64_t need = ((unsigned __int128)count * p->ticks_per_byte) >> 16;
+    // TSC at which count bytes are available
+    uint64_t at = p->tat + need - p->burst_ticks;
+    int64_t left = (int64_t)(at - __rdtsc());
+    if (left <= 0) return;
+
+    uint64_t left_ns = left / p->ticks_per_ns;
+    if (left_ns > PACE_SPIN_NS)
+    {
+        left_ns -= PACE_SPIN_NS;
+        struct timespec ts = {.tv_sec = left_ns / 1000000000ull,
+            .tv_nsec = left_ns % 1000000000ull};
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+    }
+
+    while ((int64_t)(at - __rdtsc()) > 0)
+        _mm_pause();
+}
+
+/* Same as bq_pushbuf on [q], with [*len] limited by [p] */
+static void *pace_pushbuf(pace *p, bq *q, size_t *len)
+{
+    void *buf = bq_pushbuf(q, len);
+    size_t avail = pace_avail(p);
+    if (*len > avail) *len = avail;
+    return buf;
+}
+
+/* Same as bq_push on [q], spending [count] bytes from [p] */
+static void pace_push(pace *p, bq *q, size_t count)
+{
+    bq_push(q, count);
+    pace_spend(p, count);
+}
+
+/* Same as bq_popbuf on [q], with [*len] limited by [p] */
+static void *pace_popbuf(pace *p, bq *q, size_t *len)
+{
+    void *buf = bq_popbuf(q, len);
+    size_t avail = pace_avail(p);
+    if (*len > avail) *len = avail;
+    return buf;
+}
+
+/* Same as bq_pop on [q], spending [count] bytes from [p] */
+static void pace_pop(pace *p, bq *q, size_t count)
+{
+    bq_pop(q, count);
+    pace_spend(p, count);
+}
+
+#endif
@@ -0,0 +1,305 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PCQ_H
+#define PCQ_H
+
+/* A per-CPU record queue for many producers and a single consumer.
+ * There is one lane per CPU. A producer always reserves space in the
+ * lane of the CPU it is running on, so producers on different CPUs
+ * never touch the same lane and the only contention left is between
+ * threads scheduled on the same CPU. That one is solved without atomic
+ * instructions by Linux restartable sequences (rseq): the reservation
+ * is a critical section that the kernel aborts if the thread is
+ * preempted, migrated or signaled before its final store, in which
+ * case the producer simply retries. Some notable facts:
+ * 1: A lane is a ring of records, not of bytes, because producers on
+ *      the same CPU can be preempted between the reservation and the
+ *      commit of their record, so the consumer must be able to tell
+ *      which reserved records are complete. Each record starts with
+ *      an 8 byte header holding its length and a BUSY flag. The flag
+ *      is set inside the critical section and cleared, with release
+ *      consistency, by pcq_commit.
+ * 2: As in bq.h, the lane size is a power of 2 and reserve and head
+ *      are stored without the modulo. Records never wrap: when the
+ *      space left before the end of the lane is not enough, it is
+ *      filled by a PAD record and the record starts at offset 0.
+ * 3: Records of a single lane are consumed in order, so a record whose
+ *      producer is preempted before the commit stalls its lane (not the
+ *      others) until the producer runs again.
+ * 4: There is no FIFO order between lanes. A thread that migrates
+ *      between two pushes can see its records consumed out of order.
+ * 5: When rseq is not available (no glibc registration, not x86_64, or
+ *      less lanes than configured CPUs), producers fall back to a spin
+ *      lock per lane and pick it with sched_getcpu.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sched.h>
+#include <sys/sysinfo.h>
+
+#if defined(__x86_64__) && __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define PCQ_HAS_RSEQ 1
+#else
+#define PCQ_HAS_RSEQ 0
+#endif
+
+#define PCQ_HDR_SIZE    8ULL
+#define PCQ_BUSY        1ULL
+#define PCQ_PAD         2ULL
+
+// Size taken in the lane by a record with a payload of [len] bytes
+#define PCQ_RECORD_SIZE(len) (PCQ_HDR_SIZE + (((len) + 7) & ~7ULL))
+
+typedef struct
+{
+    // Written only by producers on the CPU owning the lane
+    _Alignas(64) uint64_t reserve;
+    uint32_t lock;
+    uint64_t mask;
+    char *data;
+    // Written only by the consumer
+    _Alignas(64) uint64_t head;
+} pcq_lane;
+
+typedef struct
+{
+    pcq_lane *lanes;
+    unsigned nlanes;
+    int use_rseq;
+    // Consumer private state
+    unsigned next;
+    pcq_lane *cur;
+    uint64_t cur_size;
+} pcq;
+
+#if PCQ_HAS_RSEQ
+static inline struct rseq *pcq_rseq_(void)
+{
+    return (struct rseq *)((char *)__builtin_thread_pointer() + __rseq_offset);
+}
+
+/* The critical section: if the thread is still on [cpu] and the lane
+ * reserve is still [expect], writes the busy header [hdrval] in [hdr]
+ * and commits the reservation by storing [newv] in the reserve.
+ * Returns 0 on commit, -1 if the caller has to retry. */
+static inline int pcq_rseq_reserve_(uint64_t *reserve, uint64_t expect,
+    uint64_t newv, uint64_t *hdr, uint64_t hdrval, int cpu)
+{
+    __asm__ __volatile__ goto (
+        ".pushsection __rseq_cs, \"aw\"\n\t"
+        ".balign 32\n\t"
+        "3:\n\t"
+        ".long 0x0, 0x0\n\t"
+        ".quad 1f, (2f - 1f), 4f\n\t"
+        ".popsection\n\t"
+        "leaq 3b(%%rip), %%rax\n\t"
+        "movq %%rax, %%fs:%c[cs_off](%[rseq_off])\n\t"
+        "1:\n\t"
+        "cmpl %[cpu], %%fs:%c[cpu_off](%[rseq_off])\n\t"
+        "jnz 4f\n\t"
+        "cmpq %[reserve], %[expect]\n\t"
+        "jnz %l[retry]\n\t"
+        "movq %[hdrval], (%[hdr])\n\t"
+        "movq %[newv], %[reserve]\n\t"
+        "2:\n\t"
+        ".pushsection __rseq_failure, \"ax\"\n\t"
+        // Signature expected by the kernel right before the abort handler
+        ".byte 0x0f, 0xb9, 0x3d\n\t"
+        ".long 0x53053053\n\t"
+        "4:\n\t"
+        "jmp %l[retry]\n\t"
+        ".popsection\n\t"
+        :
+        : [cpu] "r" (cpu), [rseq_off] "r" ((long)__rseq_offset),
+          [cs_off] "i" (offsetof(struct rseq, rseq_cs)),
+          [cpu_off] "i" (offsetof(struct rseq, cpu_id)),
+          [reserve] "m" (*reserve), [expect] "r" (expect), [newv] "r" (newv),
+          [hdr] "r" (hdr), [hdrval] "r" (hdrval)
+        : "memory", "cc", "rax"
+        : retry);
+    return 0;
+retry:
+    return -1;
+}
+#endif
+
+/* Initializes [q] with the [nlanes] lanes in [lanes], sharing between
+ * them the buffer [buf] of size [len]. Each lane takes the biggest power
+ * of two fully contained in len / nlanes. For producers to use rseq,
+ * [nlanes] MUST be at least the number of configured CPUs.
+ * Returns 0 on success, -1 if a lane would be smaller than 16 bytes. */
+static int pcq_init(pcq *q, pcq_lane *lanes, unsigned nlanes, char *buf, size_t len)
+{
+    if (!q || !lanes || !nlanes || !buf) return -1;
+
+    size_t lane_len = len / nlanes;
+    if (lane_len < 16) return -1;
+    size_t cap = 1UL << (63 - __builtin_clzl(lane_len));
+
+    for (unsigned i = 0; i < nlanes; i++)
+        lanes[i] = (pcq_lane){.reserve = 0, .lock = 0, .mask = cap - 1,
+            .data = buf + i * cap, .head = 0};
+
+    int use_rseq = 0;
+#if PCQ_HAS_RSEQ
+    use_rseq = __rseq_size > 0 && (int)pcq_rseq_()->cpu_id >= 0 &&
+        nlanes >= (unsigned)get_nprocs_conf();
+#endif
+    *q = (pcq){.lanes = lanes, .nlanes = nlanes, .use_rseq = use_rseq};
+    return 0;
+}
+
+/* Reserves, in the lane of the calling CPU, a record with a payload of
+ * [len] bytes. Returns a pointer to the payload, or NULL if the lane is
+ * too full. The record is invisible to the consumer until pcq_commit
+ * is called with the returned pointer. */
+static void *pcq_reserve(pcq *q, size_t len)
+{
+    uint64_t need = PCQ_RECORD_SIZE(len);
+
+    for (;;)
+    {
+        pcq_lane *l;
+        int cpu = 0;
+#if PCQ_HAS_RSEQ
+        if (q->use_rseq)
+        {
+            cpu = __atomic_load_n(&pcq_rseq_()->cpu_id, __ATOMIC_RELAXED);
+            l = q->lanes + cpu;
+        }
+        else
+#endif
+        {
+            l = q->lanes + (unsigned)sched_getcpu() % q->nlanes;
+            while (__atomic_exchange_n(&l->lock, 1, __ATOMIC_ACQUIRE))
+                sched_yield();
+        }
+
+        uint64_t cap = l->mask + 1;
+        uint64_t head = __atomic_load_n(&l->head, __ATOMIC_ACQUIRE);
+        uint64_t reserve = __atomic_load_n(&l->reserve, __ATOMIC_RELAXED);
+        uint64_t off = reserve & l->mask;
+        // When the record does not fit before the end of the lane, the
+        // reservation also takes the remaining space, which becomes a PAD
+        uint64_t pad = cap - off < need ? cap - off : 0;
+        uint64_t *hdr = (uint64_t *)(l->data + off);
+        uint64_t hdrval = pad ? ((pad - PCQ_HDR_SIZE) << 2) | PCQ_PAD | PCQ_BUSY
+                              : ((uint64_t)len << 2) | PCQ_BUSY;
+
+        if (need > cap || reserve + pad + need - head > cap)
+        {
+            if (!q->use_rseq)
+                __atomic_store_n(&l->lock, 0, __ATOMIC_RELEASE);
+            return NULL;
+        }
+
+#if PCQ_HAS_RSEQ
+        if (q->use_rseq)
+        {
+            if (pcq_rseq_reserve_(&l->reserve, reserve, reserve + pad + need,
+                hdr, hdrval, cpu))
+                continue;
+        }
+        else
+#endif
+        {
+            *hdr = hdrval;
+            // Release so that the consumer, which reads reserve with
+            // acquire consistency, never sees a stale header
+            __atomic_store_n(&l->reserve, reserve + pad + need, __ATOMIC_RELEASE);
+            __atomic_store_n(&l->lock, 0, __ATOMIC_RELEASE);
+        }
+
+        if (pad)
+        {
+            // The record goes at offset 0. Its busy header must be in place
+            // before the PAD is released to the consumer.
+            *(uint64_t *)l->data = ((uint64_t)len << 2) | PCQ_BUSY;
+            __atomic_store_n(hdr, hdrval & ~PCQ_BUSY, __ATOMIC_RELEASE);
+            hdr = (uint64_t *)l->data;
+        }
+
+        return hdr + 1;
+    }
+}
+
+/* Makes the record whose payload is [payload], returned by pcq_reserve,
+ * visible to the consumer. It can be called from any CPU. */
+static void pcq_commit(pcq *q, void *payload)
+{
+    (void)q;
+    uint64_t *hdr = (uint64_t *)payload - 1;
+    __atomic_store_n(hdr, *hdr & ~PCQ_BUSY, __ATOMIC_RELEASE);
+}
+
+/* Returns the payload of the next committed record, looking at the lanes
+ * in round robin, and sets [*len] to its length. Returns NULL if no lane
+ * has a committed record. The record stays in the queue until pcq_pop. */
+static void *pcq_popbuf(pcq *q, size_t *len)
+{
+    for (unsigned n = 0; n < q->nlanes; n++)
+    {
+        pcq_lane *l = q->lanes + q->next;
+        q->next = q->next + 1 == q->nlanes ? 0 : q->next + 1;
+
+        for (;;)
+        {
+            uint64_t reserve = __atomic_load_n(&l->reserve, __ATOMIC_ACQUIRE);
+            if (l->head == reserve) break;
+
+            uint64_t *hdr = (uint64_t *)(l->data + (l->head & l->mask));
+            uint64_t hdrval = __atomic_load_n(hdr, __ATOMIC_ACQUIRE);
+            if (hdrval & PCQ_BUSY) break;
+
+            uint64_t size = PCQ_RECORD_SIZE(hdrval >> 2);
+            if (hdrval & PCQ_PAD)
+            {
+                __atomic_store_n(&l->head, l->head + size, __ATOMIC_RELEASE);
+                continue;
+            }
+
+            q->cur = l;
+            q->cur_size = size;
+            *len = hdrval >> 2;
+            return hdr + 1;
+        }
+    }
+
+    return NULL;
+}
+
+/* Pops the record returned by the last pcq_popbuf */
+static void pcq_pop(pcq *q)
+{
+    __atomic_store_n(&q->cur->head, q->cur->head + q->cur_size, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,380 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PLN_H
+#define PLN_H
+
+/* A runtime for pipelines of threads connected by byte queues, declared
+ * as a graph, placed on the CPUs by topology (see topo.h) and monitored.
+ * Some notable facts:
+ * 1: A stage is a function called in a loop by its own thread, with its
+ *      input and output queues in the order they were connected. It
+ *      returns how much work it did, 0 when it had nothing to do, or
+ *      PLN_DONE when it is finished. Sources have no inputs, sinks no
+ *      outputs, and any stage can have up to PLN_MAX_PORTS of each, for
+ *      fan in and fan out.
+ * 2: Stages are placed from the sources, following the edges: each stage
+ *      goes on a free CPU, the closest to the one of its first producer,
+ *      or on the least loaded one when none is free. A stage with its
+ *      cpu field set before pln_start stays there, and pln_start fails
+ *      if that CPU is not a usable one of the topology, or above
+ *      CPU_SETSIZE without one. Without a topology the threads are only
+ *      pinned where preset.
+ * 3: A ring of size 0 is sized from the cache shared by the CPUs of its
+ *      two stages: a quarter of it, between PLN_RING_MIN and
+ *      PLN_RING_MAX, so that the ring and the data around it stay in it.
+ * 4: pln_stop stops calling the sources. Every other stage ends once all
+ *      the stages feeding it ended and its inputs are empty, so the data
+ *      in flight is drained. pln_wait samples the occupancy of each ring
+ *      until all the stages ended. If pln_start fails, the stages started
+ *      are stopped at once, without draining, and joined.
+ * 5: pln_report prints the throughput and the occupancy of each ring:
+ *      the stage after a ring mostly full is the bottleneck. Rings are
+ *      read from a third thread, so bq MUST not be built with BQ_SINGLE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "bq.h"
+#include "topo.h"
+
+#define PLN_MAX_STAGES  32
+#define PLN_MAX_EDGES   64
+#define PLN_MAX_PORTS   8
+#define PLN_DONE        -1
+#define PLN_SPINS       64
+#define PLN_RING        (1024*1024ull)
+#define PLN_RING_MIN    (64*1024ull)
+#define PLN_RING_MAX    (16*1024*1024ull)
+
+typedef struct pln_stage pln_stage;
+typedef long (*pln_fn)(pln_stage *s);
+
+struct pln_stage
+{
+    const char *name;
+    pln_fn fn;
+    void *ctx;
+    bq *in[PLN_MAX_PORTS], *out[PLN_MAX_PORTS];
+    unsigned nin, nout;
+    int cpu;
+    // Runtime
+    struct pln *p;
+    pthread_t thread;
+    int done;
+    uint64_t calls, idle;
+};
+
+typedef struct
+{
+    unsigned from, to;
+    size_t size;
+    bq q;
+    // Monitor
+    uint64_t samples, fill_sum;
+    size_t fill_max;
+} pln_edge;
+
+typedef struct pln
+{
+    pln_stage stage[PLN_MAX_STAGES];
+    pln_edge edge[PLN_MAX_EDGES];
+    unsigned nstages, nedges;
+    int stopping;
+    uint64_t start_ns, end_ns;
+} pln;
+
+static uint64_t pln_now_ns_(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void pln_init(pln *p)
+{
+    memset(p, 0, sizeof(*p));
+}
+
+/* Adds to [p] the stage [name] running [fn] with [ctx]. Returns its id,
+ * -1 if there are already PLN_MAX_STAGES. */
+static int pln_add(pln *p, const char *name, pln_fn fn, void *ctx)
+{
+    if (p->nstages == PLN_MAX_STAGES) return -1;
+    pln_stage *s = p->stage + p->nstages;
+    *s = (pln_stage){.name = name, .fn = fn, .ctx = ctx, .cpu = -1, .p = p};
+    return p->nstages++;
+}
+
+/* Connects the next output of the stage [from] to the next input of the
+ * stage [to] with a ring of [size] bytes, 0 to size it by topology.
+ * Returns the id of the edge, -1 if there are no ports left. */
+static int pln_connect(pln *p, int from, int to, size_t size)
+{
+    pln_stage *a = p->stage + from, *b = p->stage + to;
+    if (p->nedges == PLN_MAX_EDGES || a->nout == PLN_MAX_PORTS || b->nin == PLN_MAX_PORTS)
+        return -1;
+    pln_edge *e = p->edge + p->nedges;
+    *e = (pln_edge){.from = from, .to = to, .size = size};
+    a->out[a->nout++] = &e->q;
+    b->in[b->nin++] = &e->q;
+    return p->nedges++;
+}
+
+static void pln_place_(pln *p, const topo *t)
+{
+    unsigned load[TOPO_MAX_CPUS] = {0}, order[PLN_MAX_STAGES], n = 0;
+    unsigned char queued[PLN_MAX_STAGES] = {0};
+    for (unsigned i = 0; i < p->nstages; i++)
+        if (p->stage[i].cpu >= 0) load[p->stage[i].cpu]++;
+
+    // Sources first, then along the edges, then whatever is left
+    for (unsigned i = 0; i < p->nstages; i++)
+        if (!p->stage[i].nin) order[n++] = i, queued[i] = 1;
+    for (unsigned k = 0; k < p->nstages; k++)
+    {
+        if (k == n)
+            for (unsigned i = 0; i < p->nstages && k == n; i++)
+                if (!queued[i]) order[n++] = i, queued[i] = 1;
+        for (unsigned e = 0; e < p->nedges; e++)
+            if (p->edge[e].from == order[k] && !queued[p->edge[e].to])
+                order[n++] = p->edge[e].to, queued[p->edge[e].to] = 1;
+    }
+
+    for (unsigned k = 0; k < n; k++)
+    {
+        pln_stage *s = p->stage + order[k];
+        if (s->cpu >= 0) continue;
+
+        int ref = -1;
+        for (unsigned e = 0; e < p->nedges && ref < 0; e++)
+            if (p->edge[e].to == order[k]) ref = p->stage[p->edge[e].from].cpu;
+
+        // A free CPU beats a shared one, then the closest wins
+        unsigned best = ~0u;
+        for (unsigned c = 0; c < t->n; c++)
+        {
+            if (!t->cpu[c].usable) continue;
+            unsigned key = load[c] * (TOPO_FAR + 1) + (ref >= 0 ? topo_distance(t, ref, c) : 0);
+            if (key < best)
+            {
+                best = key;
+                s->cpu = c;
+            }
+        }
+        if (best != ~0u) load[s->cpu]++;
+    }
+}
+
+static void *pln_thread_(void *arg)
+{
+    pln_stage *s = arg;
+    pln *p = s->p;
+    unsigned id = s - p->stage;
+
+    for (unsigned idle = 0;;)
+    {
+        int stopping = __atomic_load_n(&p->stopping, __ATOMIC_RELAXED);
+        if (stopping > 1 || (!s->nin && stopping)) break;
+
+        // Read before the call: what the upstream pushed before ending is
+        // seen by it
+        int upstream_done = 1;
+        for (unsigned e = 0; e < p->nedges; e++)
+            if (p->edge[e].to == id && !__atomic_load_n(&p->stage[p->edge[e].from].done, __ATOMIC_ACQUIRE))
+                upstream_done = 0;
+
+        long r = s->fn(s);
+        s->calls++;
+        if (r == PLN_DONE) break;
+        if (r > 0)
+        {
+            idle = 0;
+            continue;
+        }
+
+        s->idle++;
+        if (upstream_done && s->nin)
+        {
+            size_t left = 0, len;
+            for (unsigned i = 0; i < s->nin; i++, left += len)
+                bq_popbuf(s->in[i], &len);
+            if (!left) break;
+        }
+        if (idle++ < PLN_SPINS) _mm_pause();
+        else sched_yield();
+    }
+
+    __atomic_store_n(&s->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* Places the stages of [p] on the CPUs of [t], or nowhere if NULL,
+ * allocates the rings and starts the threads. Returns 0 on success, -1
+ * if a preset cpu is invalid or on failure, with the threads already
+ * started stopped and joined.
+ * pln_free must be called either way. */
+static int pln_start(pln *p, const topo *t)
+{
+    for (unsigned i = 0; i < p->nstages; i++)
+    {
+        int cpu = p->stage[i].cpu;
+        if (cpu >= 0 && (t ? (unsigned)cpu >= t->n || !t->cpu[cpu].usable : cpu >= CPU_SETSIZE))
+            return -1;
+    }
+    if (t) pln_place_(p, t);
+
+    for (unsigned i = 0; i < p->nedges; i++)
+    {
+        pln_edge *e = p->edge + i;
+        int a = p->stage[e->from].cpu, b = p->stage[e->to].cpu;
+        if (!e->size)
+        {
+            size_t shared = t && a >= 0 && b >= 0 ? topo_shared_cache(t, a, b) : 0;
+            e->size = shared ? shared / 4 : PLN_RING;
+            e->size = e->size < PLN_RING_MIN ? PLN_RING_MIN : e->size > PLN_RING_MAX ? PLN_RING_MAX : e->size;
+        }
+        // Also the alignment, aligned_alloc wants a multiple of it
+        e->size = e->size < 64 ? 64 : e->size;
+        while (e->size & (e->size - 1))
+            e->size &= e->size - 1;
+
+        char *buf = aligned_alloc(64, e->size);
+        if (!buf) return -1;
+        e->q = bq_make(buf, e->size);
+    }
+
+    p->start_ns = pln_now_ns_();
+    for (unsigned i = 0; i < p->nstages; i++)
+    {
+        pln_stage *s = p->stage + i;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (s->cpu >= 0)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(s->cpu, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        int err = pthread_create(&s->thread, &attr, pln_thread_, s);
+        pthread_attr_destroy(&attr);
+        if (err)
+        {
+            // Stages waiting for data that will never come stop as well
+            __atomic_store_n(&p->stopping, 2, __ATOMIC_RELAXED);
+            while (i--)
+                pthread_join(p->stage[i].thread, NULL);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Stops calling the sources of [p], the rest drains */
+static void pln_stop(pln *p)
+{
+    __atomic_store_n(&p->stopping, 1, __ATOMIC_RELAXED);
+}
+
+/* Samples the occupancy of the rings of [p] */
+static void pln_sample(pln *p)
+{
+    for (unsigned i = 0; i < p->nedges; i++)
+    {
+        pln_edge *e = p->edge + i;
+        size_t head = __atomic_load_n(&e->q.head, __ATOMIC_RELAXED);
+        size_t fill = __atomic_load_n(&e->q.tail, __ATOMIC_RELAXED) - head;
+        fill = fill > e->size ? e->size : fill;
+        e->samples++;
+        e->fill_sum += fill;
+        e->fill_max = fill > e->fill_max ? fill : e->fill_max;
+    }
+}
+
+/* Waits for all the stages of [p] to end, sampling the rings every
+ * [sample_us] microseconds */
+static void pln_wait(pln *p, unsigned sample_us)
+{
+    for (;;)
+    {
+        pln_sample(p);
+        unsigned running = 0;
+        for (unsigned i = 0; i < p->nstages; i++)
+            running += !__atomic_load_n(&p->stage[i].done, __ATOMIC_ACQUIRE);
+        if (!running) break;
+        usleep(sample_us);
+    }
+
+    for (unsigned i = 0; i < p->nstages; i++)
+        pthread_join(p->stage[i].thread, NULL);
+    p->end_ns = pln_now_ns_();
+}
+
+/* Prints the stages and the rings of [p], after pln_wait */
+static void pln_report(const pln *p, FILE *f)
+{
+    double s = (p->end_ns - p->start_ns) / 1e9;
+    fprintf(f, "%-16s %6s %12s %8s\n", "stage", "cpu", "calls", "idle %");
+    for (unsigned i = 0; i < p->nstages; i++)
+    {
+        const pln_stage *st = p->stage + i;
+        fprintf(f, "%-16s %6d %12lu %8.1f\n", st->name, st->cpu, (unsigned long)st->calls,
+            st->calls ? 100.0 * st->idle / st->calls : 0.0);
+    }
+
+    fprintf(f, "%-33s %8s %10s %10s %8s %8s\n", "ring", "KB", "MB", "MB/s", "avg %", "max %");
+    for (unsigned i = 0; i < p->nedges; i++)
+    {
+        const pln_edge *e = p->edge + i;
+        char name[64];
+        snprintf(name, sizeof(name), "%s -> %s", p->stage[e->from].name, p->stage[e->to].name);
+        double mb = e->q.head / (double)(1 << 20);
+        fprintf(f, "%-33s %8zu %10.1f %10.1f %8.1f %8.1f\n", name, e->size >> 10, mb, mb / s,
+            e->samples ? 100.0 * e->fill_sum / e->samples / e->size : 0.0,
+            100.0 * e->fill_max / e->size);
+    }
+}
+
+/* Frees the rings of [p], after pln_wait or a failed pln_start */
+static void pln_free(pln *p)
+{
+    for (unsigned i = 0; i < p->nedges; i++)
+        free(p->edge[i].q.data);
+}
+
+#endif
@@ -31,7 +31,7 @@
 
 struct measure
 {
-    char *label;
+    const char *label;
     uint64_t clocks;
     uint64_t executions;
 };
@@ -46,7 +46,7 @@ static inline uint64_t prf_mfence_(void)
     return 0;
 }
 
-static void prf_measure_(char *label, uint64_t id, uint64_t clocks)
+static void prf_measure_(const char *label, uint64_t id, uint64_t clocks)
 {
     profiler_m__[id].label = label;
     profiler_m__[id].clocks += clocks;
@@ -59,7 +59,7 @@ for (uint64_t d__ = 0, f__ = prf_mfence_(), s__ = _rdtsc();
 _mm_mfence(), prf_measure_((label), __COUNTER__, _rdtsc() - s__), d__ = 1, (void)f__)
 
 #define PROFILER_GLOBAL_END                                                                     \
-struct measure profiler_m__[__COUNTER__ + 1] = {0};                                             \
+struct measure profiler_m__[__COUNTER__ + 1];                                                    \
 static void prf_output_measures(FILE *stream)                                                   \
 {                                                                                               \
     fputs("====== PROFILER START ======\n", stream);                                            \
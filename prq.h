@@ -0,0 +1,141 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PRQ_H
+#define PRQ_H
+
+/* A group of byte queues (lanes) between one producer and one consumer,
+ * consumed by priority. The producer picks the lane of each message,
+ * the consumer pops from the group and gets the lane to serve next.
+ * Some notable facts:
+ * 1: Each lane is a plain bq, so the producer side costs exactly as
+ *      much as a bq and the lanes need no synchronization between them.
+ * 2: Lanes with a quantum of 0 are strict priority lanes: they are
+ *      served, in lane order, whenever they are not empty. Lane 0 is
+ *      looked at on every prq_popbuf, so an urgent message waits at
+ *      most for the bytes the consumer is already holding.
+ * 3: Lanes with a quantum > 0 share what is left with deficit round
+ *      robin: on its turn a lane gets [quantum] more bytes of credit,
+ *      prq_popbuf never returns more bytes than the credit and prq_pop
+ *      spends it. An empty lane loses its credit. In the long run each
+ *      busy lane gets a share of bytes proportional to its quantum.
+ * 4: Lanes are byte streams, so a weighted lane can be cut in the middle
+ *      of a message. Framing is up to the user, as with bq.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bq.h"
+
+#define PRQ_MAX_LANES 8
+
+typedef struct
+{
+    bq lanes[PRQ_MAX_LANES];
+    unsigned nlanes;
+    // Consumer private state
+    size_t quantum[PRQ_MAX_LANES];
+    size_t deficit[PRQ_MAX_LANES];
+    unsigned cur;
+} prq;
+
+/* Initializes [q] with the [nlanes] byte queues [lanes] and their
+ * [quantum] (see above). A NULL [quantum] makes all lanes strict
+ * priority lanes. [nlanes] MUST be at most PRQ_MAX_LANES. */
+static void prq_init(prq *q, const bq *lanes, unsigned nlanes, const size_t *quantum)
+{
+    *q = (prq){.nlanes = nlanes, .cur = 0};
+    for (unsigned i = 0; i < nlanes; i++)
+    {
+        q->lanes[i] = lanes[i];
+        q->quantum[i] = quantum ? quantum[i] : 0;
+    }
+}
+
+/* Producer side: same as bq_pushbuf on the lane [lane] of [q] */
+static void *prq_pushbuf(prq *q, unsigned lane, size_t *len)
+{
+    return bq_pushbuf(q->lanes + lane, len);
+}
+
+/* Producer side: same as bq_push on the lane [lane] of [q] */
+static void prq_push(prq *q, unsigned lane, size_t count)
+{
+    bq_push(q->lanes + lane, count);
+}
+
+/* Given the lane group [q], returns a pointer to the buffer of poppable
+ * bytes of the lane to serve next, sets [*lane] to that lane and [*len]
+ * to the len of the buffer. Sets [*len] to 0 if all lanes are empty. */
+static void *prq_popbuf(prq *q, size_t *len, unsigned *lane)
+{
+    void *buf;
+
+    for (unsigned i = 0; i < q->nlanes; i++)
+    {
+        if (q->quantum[i]) continue;
+        buf = bq_popbuf(q->lanes + i, len);
+        if (*len)
+        {
+            *lane = i;
+            return buf;
+        }
+    }
+
+    // One full round, plus the lane we are on
+    for (unsigned n = 0; n <= q->nlanes; n++)
+    {
+        unsigned i = q->cur;
+        if (q->quantum[i] && q->deficit[i])
+        {
+            buf = bq_popbuf(q->lanes + i, len);
+            if (*len)
+            {
+                if (*len > q->deficit[i]) *len = q->deficit[i];
+                *lane = i;
+                return buf;
+            }
+            q->deficit[i] = 0;
+        }
+
+        q->cur = i + 1 == q->nlanes ? 0 : i + 1;
+        q->deficit[q->cur] += q->quantum[q->cur];
+    }
+
+    *len = 0;
+    return NULL;
+}
+
+/* Given the lane group [q], pops [count] bytes from the lane [lane].
+ * [count] MUST be less than or equal to the len returned by the last
+ * prq_popbuf for that lane. */
+static void prq_pop(prq *q, unsigned lane, size_t count)
+{
+    bq_pop(q->lanes + lane, count);
+    if (q->quantum[lane])
+        q->deficit[lane] -= count;
+}
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RBA_H
+#define RBA_H
+
+/* A ring allocator for blocks freed in about the order they were
+ * allocated, on top of a byte queue: allocating pushes a block, freeing
+ * pops it. Some notable facts:
+ * 1: A block starts with an 8 byte header holding its size and a FREED
+ *      bit. Blocks never wrap: when the space left before the end of the
+ *      buffer is not enough, it becomes a block already freed and the
+ *      allocation starts at offset 0.
+ * 2: The payload is aligned to at least RBA_ALIGN. When the alignment
+ *      leaves a gap after the header, a second header right before the
+ *      payload holds the distance from the first, so a block is found
+ *      from its payload in both cases.
+ * 3: Freeing sets the FREED bit, then pops all the freed blocks from the
+ *      head up to the first one still in use. A block freed out of order
+ *      is reclaimed as soon as the ones before it are freed: small
+ *      reorderings cost nothing, but one long lived block holds all the
+ *      space behind it.
+ * 4: rba_alloc returns NULL when the block does not fit. The caller falls
+ *      back on another allocator (see rba.hpp) or waits for frees.
+ * 5: As in bq.h, one thread allocates and one thread frees, possibly the
+ *      same. Passing a block to the freeing thread MUST synchronize, as
+ *      passing it through a bq does.
+ * 6: The buffer MUST be aligned to RBA_ALIGN. Block sizes, padding
+ *      included, are stored in 31 bits, so the ring uses at most 1 GB of
+ *      the buffer, the biggest power of 2 below RBA_FREED.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bq.h"
+
+#define RBA_ALIGN   16
+#define RBA_FREED   0x80000000u
+
+typedef struct
+{
+    uint32_t size;
+    uint32_t back;
+} rba_hdr_;
+
+typedef struct
+{
+    bq q;
+} rba;
+
+/* Initializes [a] with the buffer [buf] of size [len], see bq_make. At
+ * most 1 GB of [buf] is used. */
+static void rba_init(rba *a, char *buf, size_t len)
+{
+    // The padding at the end of the ring is a block as big as the ring
+    a->q = bq_make(buf, len < RBA_FREED ? len : RBA_FREED - 1);
+}
+
+/* Returns 1 if [p] was returned by rba_alloc on [a], 0 otherwise */
+static int rba_owns(const rba *a, const void *p)
+{
+    return (const char *)p >= a->q.data && (const char *)p < a->q.data + a->q.mask + 1;
+}
+
+/* Returns a block of [size] bytes aligned to [align], a power of 2, or
+ * NULL if it does not fit */
+static void *rba_alloc(rba *a, size_t size, size_t align)
+{
+    if (align < RBA_ALIGN) align = RBA_ALIGN;
+    // The ring is below RBA_FREED, so RBA_FREED - align does not wrap
+    if (align > a->q.mask + 1 || size >= RBA_FREED - align) return NULL;
+    size = (size + sizeof(rba_hdr_) - 1) & ~(sizeof(rba_hdr_) - 1);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        size_t len;
+        char *start = (char *)bq_pushbuf(&a->q, &len);
+        uintptr_t payload = ((uintptr_t)start + sizeof(rba_hdr_) + align - 1) & ~(uintptr_t)(align - 1);
+        size_t total = payload + size - (uintptr_t)start;
+
+        if (total <= len)
+        {
+            rba_hdr_ *h = (rba_hdr_ *)start;
+            rba_hdr_ *p = (rba_hdr_ *)payload - 1;
+            h->size = total;
+            h->back = 0;
+            p->size = total;
+            p->back = (char *)p - start;
+            bq_push(&a->q, total);
+            return (void *)payload;
+        }
+
+        // Not enough before the end of the buffer: pad it, if there is
+        // enough at the start
+        size_t cap = a->q.mask + 1;
+        size_t after = cap - (a->q.tail - bq_load_(&a->q.head)) - len;
+        if (pass || (a->q.tail & a->q.mask) + len != cap || after < align + size)
+            return NULL;
+
+        rba_hdr_ *pad = (rba_hdr_ *)start;
+        pad->size = len | RBA_FREED;
+        pad->back = 0;
+        bq_push(&a->q, len);
+    }
+    return NULL;
+}
+
+/* Frees the block [ptr] returned by rba_alloc on [a] */
+static void rba_free(rba *a, void *ptr)
+{
+    rba_hdr_ *p = (rba_hdr_ *)ptr - 1;
+    rba_hdr_ *h = (rba_hdr_ *)((char *)p - p->back);
+    h->size |= RBA_FREED;
+
+    // Reclaim the freed blocks at the head
+    size_t head = a->q.head, tail = bq_load_(&a->q.tail), n = 0;
+    while (head + n != tail)
+    {
+        rba_hdr_ *b = (rba_hdr_ *)(a->q.data + ((head + n) & a->q.mask));
+        if (!(b->size & RBA_FREED)) break;
+        n += b->size & ~RBA_FREED;
+    }
+    if (n) bq_pop(&a->q, n);
+}
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RBA_HPP
+#define RBA_HPP
+
+/* The ring allocator of rba.h as a std::pmr::memory_resource. Some
+ * notable facts:
+ * 1: The ring buffer is allocated from the upstream resource, and so are
+ *      the blocks that do not fit in the ring: a full ring is slower, not
+ *      an error. Deallocation tells the two apart by address.
+ * 2: The threading rules of rba.h hold: one thread allocates and one
+ *      thread deallocates. Containers moving their memory between the
+ *      two sides, like a vector growing, MUST stay on one thread.
+ * 3: Resources compare equal only to themselves.
+ */
+
+#include <memory_resource>
+
+#include "bq.hpp"
+#include "rba.h"
+
+namespace bqpp
+{
+
+class ring_resource : public std::pmr::memory_resource
+{
+public:
+    /* A ring of the biggest power of 2 not above [len] bytes */
+    explicit ring_resource(size_t len,
+        std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+        : upstream_(upstream), len_(std::bit_floor(len))
+    {
+        rba_init(&a_, static_cast<char *>(upstream_->allocate(len_, RBA_ALIGN)), len_);
+    }
+
+    ring_resource(const ring_resource &) = delete;
+    ring_resource &operator=(const ring_resource &) = delete;
+    ~ring_resource() override { upstream_->deallocate(a_.q.data, len_, RBA_ALIGN); }
+
+    std::pmr::memory_resource *upstream_resource() const { return upstream_; }
+
+    /* The number of allocations that did not fit in the ring */
+    size_t fallbacks() const { return fallbacks_; }
+
+protected:
+    void *do_allocate(size_t bytes, size_t align) override
+    {
+        void *p = rba_alloc(&a_, bytes, align);
+        if (p) return p;
+        fallbacks_++;
+        return upstream_->allocate(bytes, align);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t align) override
+    {
+        if (rba_owns(&a_, p)) rba_free(&a_, p);
+        else upstream_->deallocate(p, bytes, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &o) const noexcept override
+    {
+        return this == &o;
+    }
+
+private:
+    std::pmr::memory_resource *upstream_;
+    size_t len_;
+    size_t fallbacks_ = 0;
+    rba a_;
+};
+
+}
+
+#endif
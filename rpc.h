@@ -0,0 +1,215 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RPC_H
+#define RPC_H
+
+/* A request/response channel between one client and one server, on two
+ * byte queues of records (see bqr.h): requests go from the client to
+ * the server, responses the other way. Some notable facts:
+ * 1: The record type is the method and the record ts is the request
+ *      id. The server copies both in the response, with the RPC_REPLY
+ *      flag set. The server answers the requests in the order they were
+ *      sent, as it releases each request with its response, so the
+ *      responses come back in request order: the id lets the client
+ *      check it.
+ * 2: The client can have up to RPC_MAX_INFLIGHT requests in flight and
+ *      attaches a context pointer to each, returned with its response.
+ * 3: Both sides read records in place and pop them in batches of
+ *      [batch] records, or as soon as their queue is found empty.
+ * 4: Nothing blocks: when a queue is full or empty the call returns NULL
+ *      and the caller decides whether to spin, yield or do other work.
+ * 5: Across processes, the two bq and their buffers MUST be in shared
+ *      memory mapped at the same address in both processes, because a
+ *      bq holds a pointer to its buffer. rpc_shm_create maps such a
+ *      region, to be inherited through fork.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "bq.h"
+#include "bqr.h"
+
+#define RPC_MAX_INFLIGHT 256
+#define RPC_REPLY 0x1
+
+typedef struct
+{
+    bq *req, *rsp;
+    uint64_t next_id;
+    size_t inflight;
+    void *ctx[RPC_MAX_INFLIGHT];
+    // Response reading state
+    size_t off;
+    unsigned batch, uncommitted;
+} rpc_client;
+
+typedef struct
+{
+    bq *req, *rsp;
+    // Request reading state
+    size_t off;
+    unsigned batch, uncommitted;
+} rpc_server;
+
+typedef struct
+{
+    bq req, rsp;
+    size_t len;
+} rpc_shm;
+
+/* Maps a shared region with the two byte queues of a channel, each of
+ * [ring_len] bytes, to be inherited by a child process through fork.
+ * Returns NULL on failure. */
+static rpc_shm *rpc_shm_create(size_t ring_len)
+{
+    size_t hdr = (sizeof(rpc_shm) + 63) & ~(size_t)63;
+    size_t len = hdr + 2 * ring_len;
+    char *base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return NULL;
+
+    rpc_shm *s = (rpc_shm *)base;
+    s->req = bq_make(base + hdr, ring_len);
+    s->rsp = bq_make(base + hdr + ring_len, ring_len);
+    s->len = len;
+    return s;
+}
+
+/* Unmaps the region [s] returned by rpc_shm_create */
+static void rpc_shm_free(rpc_shm *s)
+{
+    munmap(s, s->len);
+}
+
+/* Initializes the client [c] on the queues [req] and [rsp] */
+static void rpc_client_init(rpc_client *c, bq *req, bq *rsp, unsigned batch)
+{
+    *c = (rpc_client){.req = req, .rsp = rsp, .batch = batch};
+}
+
+/* Initializes the server [s] on the queues [req] and [rsp] */
+static void rpc_server_init(rpc_server *s, bq *req, bq *rsp, unsigned batch)
+{
+    *s = (rpc_server){.req = req, .rsp = rsp, .batch = batch};
+}
+
+/* Client side: starts a request to [method] with a payload of [len]
+ * bytes and returns its header, or NULL if there are too many requests
+ * in flight or the request queue is full. The payload follows the
+ * header. The request is sent by rpc_call_end. */
+static bqr_hdr *rpc_call_begin(rpc_client *c, uint16_t method, size_t len)
+{
+    if (c->inflight == RPC_MAX_INFLIGHT) return NULL;
+    bqr_hdr *h = bqr_reserve(c->req, len);
+    if (!h) return NULL;
+
+    h->type = method;
+    h->flags = 0;
+    h->ts = c->next_id;
+    return h;
+}
+
+/* Client side: sends the request [h], started by the last rpc_call_begin,
+ * and returns its id. [ctx] is returned with the response. */
+static uint64_t rpc_call_end(rpc_client *c, bqr_hdr *h, void *ctx)
+{
+    uint64_t id = c->next_id++;
+    // Responses come back in request order, so the ids in flight are
+    // consecutive and never collide in the context table
+    c->ctx[id % RPC_MAX_INFLIGHT] = ctx;
+    c->inflight++;
+    bqr_commit(c->req, h);
+    return id;
+}
+
+static void rpc_commit_(bq *q, size_t *off, unsigned *uncommitted)
+{
+    bq_pop(q, *off);
+    *off = 0;
+    *uncommitted = 0;
+}
+
+/* Client side: returns the header of the next response, sets [*ctx] to
+ * the context of its request, or returns NULL if there is none yet.
+ * The response id is in the ts field of the header. */
+static bqr_hdr *rpc_recv(rpc_client *c, void **ctx)
+{
+    bqr_hdr *h = bqr_peek(c->rsp, &c->off);
+    if (!h)
+    {
+        if (c->off) rpc_commit_(c->rsp, &c->off, &c->uncommitted);
+        return NULL;
+    }
+
+    *ctx = c->ctx[h->ts % RPC_MAX_INFLIGHT];
+    return h;
+}
+
+/* Client side: releases the response returned by the last rpc_recv */
+static void rpc_recv_done(rpc_client *c, bqr_hdr *h)
+{
+    c->inflight--;
+    c->off += BQR_SIZE(h->len);
+    if (++c->uncommitted >= c->batch)
+        rpc_commit_(c->rsp, &c->off, &c->uncommitted);
+}
+
+/* Server side: returns the header of the next request, or NULL if there
+ * is none yet. The request stays valid until rpc_reply_end. */
+static bqr_hdr *rpc_serve(rpc_server *s)
+{
+    bqr_hdr *h = bqr_peek(s->req, &s->off);
+    if (!h && s->off) rpc_commit_(s->req, &s->off, &s->uncommitted);
+    return h;
+}
+
+/* Server side: starts the response to [req] with a payload of [len]
+ * bytes and returns its header, or NULL if the response queue is full,
+ * in which case the request stays where it is. */
+static bqr_hdr *rpc_reply_begin(rpc_server *s, const bqr_hdr *req, size_t len)
+{
+    bqr_hdr *h = bqr_reserve(s->rsp, len);
+    if (!h) return NULL;
+
+    h->type = req->type;
+    h->flags = RPC_REPLY;
+    h->ts = req->ts;
+    return h;
+}
+
+/* Server side: sends the response [h] to the request [req] and releases
+ * the request. [req] MUST be the oldest request not answered yet, the one
+ * returned by the last rpc_serve. */
+static void rpc_reply_end(rpc_server *s, const bqr_hdr *req, bqr_hdr *h)
+{
+    bqr_commit(s->rsp, h);
+    s->off += BQR_SIZE(req->len);
+    if (++s->uncommitted >= s->batch)
+        rpc_commit_(s->req, &s->off, &s->uncommitted);
+}
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SVB_H
+#define SVB_H
+
+/* A codec for columns of 64 bit integers that change by small amounts,
+ * like sequence numbers and timestamps, in frames of records (see bqr.h).
+ * Some notable facts:
+ * 1: Each value is stored as the difference from the one before, zigzag
+ *      encoded so small negative differences are small too, in 1, 2, 4
+ *      or 8 bytes. As in streamvbyte, the lengths are 2 bit codes packed
+ *      in control bytes at the start of the frame, followed by the data,
+ *      so the decoder knows where each value starts without looking at
+ *      the data.
+ * 2: A frame is a record of type SVB_TYPE, with the column in its flags
+ *      field, so several columns can share a queue. The payload is the
+ *      count of values (4 bytes), the control bytes, then the data. A
+ *      frame holds at most SVB_MAX_FRAME values and, as every record,
+ *      never wraps: svb_push encodes straight in the queue as many values
+ *      as fit in the contiguous space, and svb_decode decodes straight
+ *      from it.
+ * 3: The decoder expands two values at a time with one SSSE3 pshufb, from
+ *      a table indexed by their two codes, then undoes the zigzag and the
+ *      differences in SSE2 registers. It stops 16 bytes before the end
+ *      of the frame, as the loads are 16 bytes wide, and finishes with
+ *      the scalar decoder, which is also used on CPUs without SSSE3.
+ * 4: Each side keeps the last value of each column in [*prev], starting
+ *      from 0. Frames MUST be decoded in the order they were encoded.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+#include "bq.h"
+#include "bqr.h"
+
+#define SVB_TYPE        0xfffc
+#define SVB_MAX_FRAME   1024
+
+static const int8_t svb_shuffle_[16][16] __attribute__((aligned(16))) = {
+    {0, -1, -1, -1, -1, -1, -1, -1, 1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 1, -1, -1, -1, -1, -1, -1, 2, -1, -1, -1, -1, -1, -1, -1},
+    {0, 1, 2, 3, -1, -1, -1, -1, 4, -1, -1, -1, -1, -1, -1, -1},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, -1, -1, -1, -1, -1, -1, -1},
+    {0, -1, -1, -1, -1, -1, -1, -1, 1, 2, -1, -1, -1, -1, -1, -1},
+    {0, 1, -1, -1, -1, -1, -1, -1, 2, 3, -1, -1, -1, -1, -1, -1},
+    {0, 1, 2, 3, -1, -1, -1, -1, 4, 5, -1, -1, -1, -1, -1, -1},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1, -1, -1, -1, -1, -1},
+    {0, -1, -1, -1, -1, -1, -1, -1, 1, 2, 3, 4, -1, -1, -1, -1},
+    {0, 1, -1, -1, -1, -1, -1, -1, 2, 3, 4, 5, -1, -1, -1, -1},
+    {0, 1, 2, 3, -1, -1, -1, -1, 4, 5, 6, 7, -1, -1, -1, -1},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, -1, -1, -1, -1},
+    {0, -1, -1, -1, -1, -1, -1, -1, 1, 2, 3, 4, 5, 6, 7, 8},
+    {0, 1, -1, -1, -1, -1, -1, -1, 2, 3, 4, 5, 6, 7, 8, 9},
+    {0, 1, 2, 3, -1, -1, -1, -1, 4, 5, 6, 7, 8, 9, 10, 11},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+};
+
+static uint64_t svb_zigzag_(uint64_t d)
+{
+    return d << 1 ^ (uint64_t)((int64_t)d >> 63);
+}
+
+static unsigned svb_code_(uint64_t z)
+{
+    return z >> 8 ? z >> 16 ? z >> 32 ? 3 : 2 : 1 : 0;
+}
+
+// How many of the first [n] values fit in [space] bytes of payload, with
+// the payload size in [*size]
+static size_t svb_fit_(const uint64_t *v, size_t n, uint64_t prev, size_t space, size_t *size)
+{
+    size_t k = 0, data = 0;
+    if (n > SVB_MAX_FRAME) n = SVB_MAX_FRAME;
+    for (; k < n; k++)
+    {
+        size_t len = data + (1u << svb_code_(svb_zigzag_(v[k] - prev)));
+        if (4 + (k + 4) / 4 + len > space) break;
+        data = len;
+        prev = v[k];
+    }
+    *size = 4 + (k + 3) / 4 + data;
+    return k;
+}
+
+/* Encodes in one frame of [q] the first values of [v], up to [n], for
+ * the column [col]. Returns the number of values encoded, 0 if [q] is
+ * full. */
+static size_t svb_push(bq *q, uint16_t col, const uint64_t *v, size_t n, uint64_t *prev)
+{
+    size_t size, k = svb_fit_(v, n, *prev, SIZE_MAX, &size);
+    bqr_hdr *h = bqr_reserve(q, size);
+    if (!h)
+    {
+        // Not all of them: as many as fit
+        size_t avail;
+        bq_pushbuf(q, &avail);
+        if (avail <= sizeof(bqr_hdr)) return 0;
+        k = svb_fit_(v, k, *prev, avail - sizeof(bqr_hdr), &size);
+        if (!k || !(h = bqr_reserve(q, size))) return 0;
+    }
+
+    uint8_t *ctrl = (uint8_t *)(h + 1) + 4, *op = ctrl + (k + 3) / 4;
+    uint32_t count = k;
+    memcpy(h + 1, &count, sizeof(count));
+    memset(ctrl, 0, (k + 3) / 4);
+    uint64_t last = *prev;
+    for (size_t i = 0; i < k; i++)
+    {
+        uint64_t z = svb_zigzag_(v[i] - last);
+        unsigned c = svb_code_(z);
+        ctrl[i / 4] |= c << (2 * (i % 4));
+        memcpy(op, &z, 1u << c);
+        op += 1u << c;
+        last = v[i];
+    }
+
+    h->type = SVB_TYPE;
+    h->flags = col;
+    h->ts = 0;
+    bqr_commit(q, h);
+    *prev = last;
+    return k;
+}
+
+__attribute__((target("ssse3")))
+static size_t svb_decode_ssse3_(const uint8_t *ctrl, const uint8_t **ip,
+    const uint8_t *end, uint64_t *v, size_t n, uint64_t *prev)
+{
+    const uint8_t *in = *ip;
+    __m128i last = _mm_set1_epi64x(*prev);
+    __m128i one = _mm_set1_epi64x(1), zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 2 <= n && end - in >= 16; i += 2)
+    {
+        unsigned c = ctrl[i / 4] >> (2 * (i % 4)) & 15;
+        __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)in),
+            _mm_load_si128((const __m128i *)svb_shuffle_[c]));
+        in += (1u << (c & 3)) + (1u << (c >> 2));
+
+        // Zigzag, then the two sums
+        x = _mm_xor_si128(_mm_srli_epi64(x, 1), _mm_sub_epi64(zero, _mm_and_si128(x, one)));
+        x = _mm_add_epi64(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi64(x, last);
+        _mm_storeu_si128((__m128i *)(v + i), x);
+        last = _mm_unpackhi_epi64(x, x);
+    }
+    *ip = in;
+    *prev = _mm_cvtsi128_si64(last);
+    return i;
+}
+
+static int svb_decode_(const bqr_hdr *h, uint64_t *v, uint64_t *prev, int simd)
+{
+    const uint8_t *p = (const uint8_t *)(h + 1), *end = p + h->len;
+    uint32_t n;
+    if (h->type != SVB_TYPE || h->len < sizeof(n)) return -1;
+    memcpy(&n, p, sizeof(n));
+    const uint8_t *ctrl = p + sizeof(n), *ip = ctrl + (n + 3) / 4;
+    if (n > SVB_MAX_FRAME || ip > end) return -1;
+
+    uint64_t last = *prev;
+    size_t i = simd ? svb_decode_ssse3_(ctrl, &ip, end, v, n, &last) : 0;
+    for (; i < n; i++)
+    {
+        size_t len = 1u << (ctrl[i / 4] >> (2 * (i % 4)) & 3);
+        if ((size_t)(end - ip) < len) return -1;
+        uint64_t z = 0;
+        memcpy(&z, ip, len);
+        ip += len;
+        last += (z >> 1) ^ -(z & 1);
+        v[i] = last;
+    }
+    if (ip != end) return -1;
+    *prev = last;
+    return n;
+}
+
+/* Decodes the frame [h], found with bqr_peek, to [v], which MUST have
+ * room for SVB_MAX_FRAME values. Returns the number of values, -1 if the
+ * frame is corrupted. */
+static int svb_decode(const bqr_hdr *h, uint64_t *v, uint64_t *prev)
+{
+    return svb_decode_(h, v, prev, __builtin_cpu_supports("ssse3"));
+}
+
+#endif
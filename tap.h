@@ -0,0 +1,116 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TAP_H
+#define TAP_H
+
+/* A passive observer of a byte queue, copying the bytes going through it
+ * without the producer or the consumer knowing. Some notable facts:
+ * 1: The tap only reads head and tail and never writes the queue, so it
+ *      does not slow down the two sides and does not change the free
+ *      space seen by bq_pushbuf. It has its own position, a free running
+ *      index like head and tail.
+ * 2: The producer can write index i + capacity, overwriting the byte at
+ *      index i, as soon as head has passed i. So the bytes the tap can
+ *      trust are the ones between head and tail: once popped, a byte can
+ *      change at any time. The tap copies from its position up to tail,
+ *      then reads head again, after an acquire fence, and throws away
+ *      the copied bytes that are now behind it, as they can be torn.
+ * 3: Bytes the consumer pops before the tap copies them are lost for the
+ *      tap: tap_read reports them as a gap before the bytes it returns,
+ *      and counts gaps and lost bytes. A tap faster than the consumer
+ *      sees everything.
+ * 4: A copy can race with the producer writing the same bytes. The race
+ *      is detected by the second read of head and the bytes discarded,
+ *      as in a sequence lock.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bq.h"
+
+typedef struct
+{
+    bq *q;
+    size_t pos;
+    // Totals of the gaps reported by tap_read
+    uint64_t gaps, lost;
+} tap;
+
+/* Initializes [t] to observe [q], from the bytes pushed from now on */
+static void tap_init(tap *t, bq *q)
+{
+    *t = (tap){.q = q, .pos = bq_load_(&q->tail)};
+}
+
+/* Copies to [dst] at most [len] bytes of the queue of [t], from its
+ * position on. Returns the number of bytes copied and sets [*gap] to the
+ * number of bytes skipped before them, lost to the tap. */
+static size_t tap_read(tap *t, void *dst, size_t len, size_t *gap)
+{
+    bq *q = t->q;
+    // Head first: tail, read after it, can not be behind it
+    size_t head = bq_load_(&q->head);
+    size_t tail = bq_load_(&q->tail);
+    size_t skipped = 0;
+
+    // Bytes before head can be overwritten at any time
+    if ((ptrdiff_t)(head - t->pos) > 0)
+    {
+        skipped = head - t->pos;
+        t->pos = head;
+    }
+
+    size_t n = tail - t->pos;
+    if (n > len) n = len;
+    size_t off = t->pos & q->mask;
+    size_t first = n < q->mask + 1 - off ? n : q->mask + 1 - off;
+    memcpy(dst, q->data + off, first);
+    memcpy((char *)dst + first, q->data, n - first);
+
+    // Whatever head has passed during the copy can be torn
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    if ((ptrdiff_t)(head - t->pos) > 0)
+    {
+        size_t torn = head - t->pos < n ? head - t->pos : n;
+        memmove(dst, (char *)dst + torn, n - torn);
+        n -= torn;
+        skipped += torn;
+        t->pos += torn;
+    }
+
+    t->pos += n;
+    if (skipped)
+    {
+        t->gaps++;
+        t->lost += skipped;
+    }
+    *gap = skipped;
+    return n;
+}
+
+#endif
@@ -22,6 +22,8 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
@@ -29,69 +31,2236 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+#include "others/bbq.h"
+#include "others/vbq.h"
+#include "others/abq.h"
+#include "others/lfq.h"
+
+#include "bq.h"
+#include "cbq.h"
+#include "pcq.h"
+#include "wsq.h"
+#include "prq.h"
+#include "bqr.h"
+#include "bqm.h"
+#include "pace.h"
+#include "abc.h"
+#include "dlq.h"
+#include "rpc.h"
+#include "bqf.h"
+#include "rba.h"
+#include "txq.h"
+#include "tap.h"
+#include "lzb.h"
+#include "svb.h"
+#include "cbf.h"
+#include "cur.h"
+#define BUS_TIMING 1
+#include "bus.h"
+#include "pln.h"
+#include "profiler.h"
+
+#define BYTES_TO_PRODUCE    1024*1024*1024ull
+#define QUEUE_SIZE          1024*1024ull
+#define MAX_BYTES_PER_OP    1024ull
+#define MAX_SLEEP_USEC      50
+#define SINGLE_THREAD_OPS   (1024*1024ull)
+#define SINGLE_THREAD_BYTES 16ull
+#define PCQ_PRODUCERS       8
+#define PCQ_RECORDS         (256*1024ull)
+#define PCQ_MAX_RECORD      64
+#define WSQ_DEQUE_LEN       1024
+#define WSQ_FIB_N           32
+#define WSQ_FIB_CUTOFF      16
+#define WSQ_TASKS           (1024*1024ull)
+#define PRQ_LANE_SIZE       (64*1024ull)
+#define BQM_SOURCES         4
+#define BQM_RECORDS         (256*1024ull)
+#define BQM_BATCH           32
+#define PACE_BYTES          (8*1024*1024ull)
+#define PACE_RATE           (64*1024*1024ull)
+#define PACE_BURST          (64*1024ull)
+#define ABC_MSG             64ull
+#define ABC_MSGS            (16*1024ull)
+#define ABC_BUDGET_NS       100000ull
+#define ABC_MIN_BATCH       ABC_MSG
+#define ABC_MAX_BATCH       (16*1024ull)
+#define ABC_BURST_SLEEP_USEC 100
+// The adaptive latency is at most this times the best fixed one, plus
+// 5% of the budget for the scheduling noise
+#define ABC_TOLERANCE       1.5
+#define DLQ_RECORDS         (16*1024ull)
+#define RPC_ROUNDS          (16*1024ull)
+#define RPC_MSG             64
+#define RPC_PIPELINE        64
+#define RPC_BATCH           16
+#define RPC_ECHO            0
+#define RPC_STOP            1
+#define IPC_MSG             64
+#define IPC_MSGS            (256*1024ull)
+#define IPC_ROUNDS          (16*1024ull)
+#define BQF_ROUNDS          256
+#define BQF_LINES           4096
+#define BQF_BLOCK           1024
+#define BQF_BLOCKS          64
+#define RBA_OPS             (1024*1024ull)
+#define RBA_WINDOW          64
+#define RBA_MAX_BLOCK       512
+#define TXQ_MSGS            (256*1024ull)
+#define TXQ_MSG             64
+#define TXQ_ABORT_EVERY     13
+#define TAP_BYTES           (16*1024*1024ull)
+#define TAP_QUEUE_SIZE      4096
+#define TAP_MAX_CHUNK       256
+#define LZB_RECORDS         (64*1024ull)
+#define LZB_MAX_RECORD      512
+#define LZB_BENCH_ROUNDS    256
+#define SVB_VALUES          (1024*1024ull)
+#define SVB_COLUMNS         4
+#define CBF_TICKS           (1024*1024ull + 100)
+#define CBF_ROWS            1024
+#define CUR_MSGS            (256*1024ull)
+#define CUR_MAX_STR         40
+#define BUS_MSGS            (1000*1024ull)
+#define BUS_TYPES           8
+#define BUS_BATCH           64
+#define PLN_RECORDS         (1024*1024ull)
+#define PLN_BATCH           64
+#define PLN_STOP_USEC       20000
+#define TOPO_FAKE_CPUS      16
+#define TOPO_PAIRS          4
+
+// Build with -DBQ_THREADING=BQ_SINGLE or -DBQ_THREADING=BQ_CHECKED to
+// compare the threading policies of bq. With BQ_SINGLE bq can not be
+// shared with another thread, so only the single thread run uses it.
+#if BQ_THREADING == BQ_SINGLE
+#define BQ_THREADED_BYTES   0
+#else
+#define BQ_THREADED_BYTES   BYTES_TO_PRODUCE
+#endif
+
+static void single_thread_run(void);
+static void pcq_run(void);
+static void *pcq_producer_thread(void *arg);
+static void wsq_run(void);
+static void prq_run(void);
+static void bqm_run(void);
+static void *bqm_producer_thread(void *arg);
+static void pace_run(void);
+static void abc_run(void);
+static void *abc_producer_thread(void *arg);
+static void dlq_run(void);
+static void rpc_run(void);
+static void ipc_run(void);
+static void bqf_run(void);
+static void rba_run(void);
+static void *rba_consumer_thread(void *arg);
+static void txq_run(void);
+static void *txq_producer_thread(void *arg);
+static void tap_run(void);
+static void *tap_producer_thread(void *arg);
+static void *tap_consumer_thread(void *arg);
+static void lzb_run(void);
+static void svb_run(void);
+static void cbf_run(void);
+static void cur_run(void);
+static void bus_run(void);
+static void pln_run(void);
+static void topo_run(void);
+static void *producer_thread(void *arg);
+static void *consumer_thread(void *arg);
+
+static bbq bbq_queue;
+static vbq vbq_queue;
+static abq abq_queue;
+static lfq lfq_queue;
+static bq bq_queue;
+static cbq *cbq_queue;
+
+static pcq pcq_queue;
+static wsq_pool wsq_workers;
+static bq bqm_queues[BQM_SOURCES];
+
+static bool prod_finished;
+
+int main()
+{
+    srand(time(NULL));
+    prod_finished = false;
+
+    bbq_queue_init(&bbq_queue, malloc(QUEUE_SIZE), QUEUE_SIZE);
+    vbq_queue_init(&vbq_queue, malloc(QUEUE_SIZE), QUEUE_SIZE);
+    abq_queue_init(&abq_queue, malloc(QUEUE_SIZE), QUEUE_SIZE);
+    lfq_queue_init(&lfq_queue, malloc(QUEUE_SIZE), QUEUE_SIZE);
+    bq_queue = bq_make(malloc(QUEUE_SIZE), QUEUE_SIZE);
+    cbq_queue = cbq_make(malloc(CBQ_SIZE(QUEUE_SIZE)), CBQ_SIZE(QUEUE_SIZE));
+
+    assert(bbq_queue.data && vbq_queue.data &&
+        abq_queue.data && lfq_queue.data && bq_queue.data && cbq_queue);
+
+    // Start the 32 bit counters right before UINT32_MAX to also
+    // exercise the wrap around
+    cbq_queue->head = cbq_queue->tail = UINT32_MAX - (QUEUE_SIZE >> 1);
+
+    single_thread_run();
+    pcq_run();
+    wsq_run();
+    prq_run();
+    bqm_run();
+    pace_run();
+    abc_run();
+    dlq_run();
+    rpc_run();
+    ipc_run();
+    bqf_run();
+    rba_run();
+    txq_run();
+    tap_run();
+    lzb_run();
+    svb_run();
+    cbf_run();
+    cur_run();
+    bus_run();
+    pln_run();
+    topo_run();
+
+    printf("Running test on moving %llu MB, queues of %llu MB, max %llu B per operation\n", BYTES_TO_PRODUCE >> 20, QUEUE_SIZE >> 20, MAX_BYTES_PER_OP);
+    pthread_t prod, cons;
+    pthread_create(&prod, NULL, producer_thread, NULL);
+    pthread_create(&cons, NULL, consumer_thread, NULL);
+
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+    
+    free(bbq_queue.data);
+    free(vbq_queue.data);
+    free(abq_queue.data);
+    free(lfq_queue.data);
+    free(bq_queue.data);
+    free(cbq_queue);
+    bbq_queue_free(&bbq_queue);
+    vbq_queue_free(&vbq_queue);
+    abq_queue_free(&abq_queue);
+
+    puts("Test ended without errors");
+
+    prf_output_measures(stdout);
+
+    return 0;
+}
+
+static void single_thread_run(void)
+{
+    printf("Running single thread test on %llu push/pop of %llu B\n", SINGLE_THREAD_OPS, SINGLE_THREAD_BYTES);
+    bq q = bq_make(malloc(QUEUE_SIZE), QUEUE_SIZE);
+    assert(q.data);
+
+    uint8_t bytes[SINGLE_THREAD_BYTES];
+    uint8_t expected = 0, val = 0;
+
+    TIME("BQ single thread push/pop")
+    {
+        for (size_t i = 0; i < SINGLE_THREAD_OPS; i++)
+        {
+            for (size_t j = 0; j < sizeof(bytes); j++)
+                bytes[j] = val++;
+
+            size_t count;
+            uint8_t *addr = bq_pushbuf(&q, &count);
+            count = MIN(count, sizeof(bytes));
+            memcpy(addr, bytes, count);
+            bq_push(&q, count);
+
+            addr = bq_popbuf(&q, &count);
+            for (size_t j = 0; j < count; j++)
+                assert(addr[j] == expected++);
+            bq_pop(&q, count);
+        }
+    }
+
+    assert(expected == val);
+    free(q.data);
+}
+
+static void pcq_run(void)
+{
+    printf("Running per-CPU queue test with %d producers of %llu records\n", PCQ_PRODUCERS, PCQ_RECORDS);
+
+    unsigned nlanes = get_nprocs_conf();
+    pcq_lane *lanes = malloc(nlanes * sizeof(*lanes));
+    char *buf = malloc(nlanes * QUEUE_SIZE);
+    assert(lanes && buf);
+    int r = pcq_init(&pcq_queue, lanes, nlanes, buf, nlanes * QUEUE_SIZE);
+    assert(!r);
+
+    pthread_t prod[PCQ_PRODUCERS];
+    size_t count[PCQ_PRODUCERS] = {0};
+    uint64_t sum[PCQ_PRODUCERS] = {0};
+
+    TIME("PCQ run")
+    {
+        for (uintptr_t i = 0; i < PCQ_PRODUCERS; i++)
+            pthread_create(&prod[i], NULL, pcq_producer_thread, (void *)i);
+
+        for (size_t left = PCQ_PRODUCERS * PCQ_RECORDS; left > 0;)
+        {
+            size_t len;
+            uint32_t *rec = pcq_popbuf(&pcq_queue, &len);
+            if (!rec)
+            {
+                sched_yield();
+                continue;
+            }
+
+            assert(len >= 2 * sizeof(uint32_t) && len <= PCQ_MAX_RECORD);
+            assert(rec[0] < PCQ_PRODUCERS);
+            for (size_t j = 2 * sizeof(uint32_t); j < len; j++)
+                assert(((uint8_t *)rec)[j] == (uint8_t)rec[1]);
+            count[rec[0]]++;
+            sum[rec[0]] += rec[1];
+            pcq_pop(&pcq_queue);
+            left--;
+        }
+
+        for (size_t i = 0; i < PCQ_PRODUCERS; i++)
+            pthread_join(prod[i], NULL);
+    }
+
+    for (size_t i = 0; i < PCQ_PRODUCERS; i++)
+        assert(count[i] == PCQ_RECORDS &&
+            sum[i] == PCQ_RECORDS * (PCQ_RECORDS - 1) / 2);
+
+    printf("Per-CPU queue used %s\n", pcq_queue.use_rseq ? "rseq" : "the lock fallback");
+    free(lanes);
+    free(buf);
+}
+
+static void *pcq_producer_thread(void *arg)
+{
+    uint32_t id = (uintptr_t)arg;
+
+    for (uint32_t seq = 0; seq < PCQ_RECORDS; seq++)
+    {
+        size_t len = 2 * sizeof(uint32_t) + seq % (PCQ_MAX_RECORD - 2 * sizeof(uint32_t) + 1);
+        uint32_t *rec;
+        while (!(rec = pcq_reserve(&pcq_queue, len)))
+            sched_yield();
+
+        rec[0] = id;
+        rec[1] = seq;
+        memset(rec + 2, (uint8_t)seq, len - 2 * sizeof(uint32_t));
+        pcq_commit(&pcq_queue, rec);
+    }
+
+    return NULL;
+}
+
+struct fib_task
+{
+    unsigned n;
+    uint64_t res;
+};
+
+static uint64_t fib_serial(unsigned n)
+{
+    return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+static void fib_task_fn(void *arg)
+{
+    struct fib_task *t = arg;
+    if (t->n < WSQ_FIB_CUTOFF)
+    {
+        t->res = fib_serial(t->n);
+        return;
+    }
+
+    size_t pending = 0;
+    struct fib_task a = {.n = t->n - 1}, b = {.n = t->n - 2};
+    wsq_spawn(&wsq_workers, fib_task_fn, &a, &pending);
+    fib_task_fn(&b);
+    wsq_wait(&wsq_workers, &pending);
+    t->res = a.res + b.res;
+}
+
+static void count_task_fn(void *arg)
+{
+    __atomic_add_fetch((uint64_t *)arg, 1, __ATOMIC_RELAXED);
+}
+
+static void wsq_run(void)
+{
+    // At least two workers, so that stealing is exercised
+    unsigned nworkers = get_nprocs() > 2 ? get_nprocs() : 2;
+    printf("Running work-stealing test with %u workers\n", nworkers);
+    int r = wsq_pool_init(&wsq_workers, nworkers, WSQ_DEQUE_LEN, WSQ_DEQUE_LEN);
+    assert(!r);
+
+    // Fork/join: the root task is injected, everything else is spawned
+    // and stolen between the workers
+    struct fib_task root = {.n = WSQ_FIB_N};
+    size_t pending = 0;
+    TIME("WSQ fork/join fib")
+    {
+        wsq_spawn(&wsq_workers, fib_task_fn, &root, &pending);
+        wsq_wait(&wsq_workers, &pending);
+    }
+    assert(root.res == fib_serial(WSQ_FIB_N));
+
+    // Producer/consumer: a thread outside the pool injects tiny tasks
+    uint64_t done = 0;
+    TIME("WSQ injected tasks")
+    {
+        for (size_t i = 0; i < WSQ_TASKS; i++)
+            wsq_spawn(&wsq_workers, count_task_fn, &done, &pending);
+        wsq_wait(&wsq_workers, &pending);
+    }
+    assert(done == WSQ_TASKS);
+
+    wsq_pool_free(&wsq_workers);
+}
+
+static void prq_run(void)
+{
+    puts("Running priority lanes test");
+
+    // Lane 0 is strict, lanes 1 and 2 share the rest 3:1
+    bq lanes[3];
+    for (size_t i = 0; i < 3; i++)
+    {
+        lanes[i] = bq_make(malloc(PRQ_LANE_SIZE), PRQ_LANE_SIZE);
+        assert(lanes[i].data);
+    }
+    size_t quantum[3] = {0, 3 * 1024, 1024};
+    prq q;
+    prq_init(&q, lanes, 3, quantum);
+
+    for (unsigned i = 1; i < 3; i++)
+    {
+        size_t len;
+        void *addr = prq_pushbuf(&q, i, &len);
+        memset(addr, i, len);
+        prq_push(&q, i, len);
+    }
+
+    size_t served[3] = {0};
+    for (size_t op = 0; served[1] + served[2] < PRQ_LANE_SIZE; op++)
+    {
+        // Every now and then an urgent message must overtake the bulk
+        if (op % 7 == 0)
+        {
+            size_t len;
+            uint8_t *addr = prq_pushbuf(&q, 0, &len);
+            assert(len);
+            *addr = 0;
+            prq_push(&q, 0, 1);
+        }
+
+        size_t len;
+        unsigned lane = 0;
+        uint8_t *addr;
+        TIME("PRQ popbuf")
+            addr = prq_popbuf(&q, &len, &lane);
+        assert(len);
+        assert(op % 7 != 0 || lane == 0);
+        len = MIN(len, 256);
+        for (size_t i = 0; i < len; i++)
+            assert(addr[i] == lane);
+        served[lane] += len;
+        prq_pop(&q, lane, len);
+    }
+
+    // Weighted lanes get bytes in proportion to their quantum, give or
+    // take the quantum of the lane being served
+    assert(served[1] + quantum[1] >= 3 * served[2] && served[1] <= 3 * served[2] + quantum[1]);
+
+    for (size_t i = 0; i < 3; i++)
+        free(lanes[i].data);
+}
+
+static void bqm_run(void)
+{
+    printf("Running merge test on %d sources of %llu records\n", BQM_SOURCES, BQM_RECORDS);
+
+    // A record bigger than the ring leaves it untouched
+    bq big = bq_make(malloc(PRQ_LANE_SIZE), PRQ_LANE_SIZE);
+    assert(big.data && !bqr_reserve(&big, PRQ_LANE_SIZE) && big.tail == 0);
+    bqr_hdr *r = bqr_reserve(&big, 64);
+    assert(r && (char *)r == big.data);
+    bqr_commit(&big, r);
+    bq_pop(&big, BQR_SIZE(64));
+    // Wrapping pads only when the record fits before head
+    assert(!bqr_reserve(&big, PRQ_LANE_SIZE - BQR_SIZE(64)) && big.tail == BQR_SIZE(64));
+    assert((r = bqr_reserve(&big, 16)) && (char *)r == big.data + BQR_SIZE(64));
+    free(big.data);
+
+    if (BQ_THREADING == BQ_SINGLE) return;
+
+    bq *src[BQM_SOURCES];
+    pthread_t prod[BQM_SOURCES];
+    for (uintptr_t i = 0; i < BQM_SOURCES; i++)
+    {
+        bqm_queues[i] = bq_make(malloc(PRQ_LANE_SIZE), PRQ_LANE_SIZE);
+        assert(bqm_queues[i].data);
+        src[i] = bqm_queues + i;
+        pthread_create(&prod[i], NULL, bqm_producer_thread, (void *)i);
+    }
+
+    bqm m;
+    bqm_init(&m, src, BQM_SOURCES, BQM_BATCH);
+    uint64_t last_ts = 0, next_seq[BQM_SOURCES] = {0};
+
+    while (!bqm_done(&m))
+    {
+        unsigned s;
+        bqr_hdr *h;
+        TIME("BQM peek")
+            h = bqm_peek(&m, &s);
+        if (!h)
+        {
+            sched_yield();
+            continue;
+        }
+
+        assert(h->ts >= last_ts);
+        // Lengths vary so that PAD records are exercised too
+        assert(h->len == sizeof(uint64_t) * (1 + next_seq[s] % 4));
+        assert(*(uint64_t *)(h + 1) == next_seq[s]);
+        last_ts = h->ts;
+        next_seq[s]++;
+
+        TIME("BQM pop")
+            bqm_pop(&m);
+    }
+
+    for (size_t i = 0; i < BQM_SOURCES; i++)
+    {
+        pthread_join(prod[i], NULL);
+        assert(next_seq[i] == BQM_RECORDS);
+        free(bqm_queues[i].data);
+    }
+}
+
+static void *bqm_producer_thread(void *arg)
+{
+    bq *q = bqm_queues + (uintptr_t)arg;
+    uint64_t ts = 0, rng = (uintptr_t)arg + 1;
+
+    for (uint64_t seq = 0; seq <= BQM_RECORDS; seq++)
+    {
+        bqr_hdr *h;
+        while (!(h = bqr_reserve(q, sizeof(uint64_t) * (1 + seq % 4))))
+            sched_yield();
+
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+        ts += rng % 100;
+        h->ts = ts;
+        h->type = seq < BQM_RECORDS ? 0 : BQR_END;
+        *(uint64_t *)(h + 1) = seq;
+        bqr_commit(q, h);
+    }
+
+    return NULL;
+}
+
+static void pace_run(void)
+{
+    printf("Running pacing test on %llu MB at %llu MB/s\n", PACE_BYTES >> 20, PACE_RATE >> 20);
+
+    bq q = bq_make(malloc(QUEUE_SIZE), QUEUE_SIZE);
+    assert(q.data);
+    pace p;
+    pace_init(&p, PACE_RATE, PACE_BURST);
+
+    // The consumer is paced too, but faster than the producer
+    pace cp;
+    pace_init(&cp, 2 * PACE_RATE, PACE_BURST);
+
+    uint64_t start = pace_now_ns_();
+    for (size_t left = PACE_BYTES; left > 0;)
+    {
+        size_t count, want = MIN(MAX_BYTES_PER_OP, left);
+        void *addr;
+        TIME("PACE pushbuf")
+            addr = pace_pushbuf(&p, &q, &count);
+        if (count < want)
+        {
+            // Sleep until a whole op is allowed instead of spinning
+            TIME("PACE wait")
+                pace_wait(&p, want);
+            continue;
+        }
+
+        memset(addr, 0, want);
+        pace_push(&p, &q, want);
+        left -= want;
+
+        pace_popbuf(&cp, &q, &count);
+        pace_pop(&cp, &q, count);
+    }
+    uint64_t elapsed = pace_now_ns_() - start;
+
+    // The first burst is free, the rest must take its time
+    double expected = (double)(PACE_BYTES - PACE_BURST) / PACE_RATE * 1e9;
+    printf("Paced %llu MB in %.1f ms at %.1f MB/s, expected %.1f ms\n", PACE_BYTES >> 20,
+        elapsed / 1e6, (PACE_BYTES >> 20) / (elapsed / 1e9), expected / 1e6);
+    // Never faster than the rate. Slower is only checked by eye, as a busy
+    // machine can delay the producer by any amount.
+    assert(elapsed > expected * 0.95);
+
+    free(q.data);
+}
+
+struct abc_bench
+{
+    bq q;
+    abc c;
+    size_t fixed;       // 0 for the adaptive controller
+    size_t burst;       // messages per burst
+};
+
+static void abc_run(void)
+{
+    static const size_t bursts[] = {4, 64, 1024};
+    static const size_t fixed[] = {ABC_MSG, 1024, ABC_MAX_BATCH, 0};
+
+    printf("Running bursty load test on %llu messages of %llu B, latency budget %llu us\n", ABC_MSGS, ABC_MSG, ABC_BUDGET_NS / 1000);
+    if (BQ_THREADING == BQ_SINGLE) return;
+    printf("%-12s %-10s %14s %14s\n", "msgs/burst", "batch", "avg lat (us)", "B per pop");
+
+    double ticks_per_us = pace_tsc_per_ns() * 1000;
+
+    for (size_t b = 0; b < sizeof(bursts) / sizeof(bursts[0]); b++)
+    {
+        // The adaptive row comes last
+        double best = 1e30;
+        for (size_t f = 0; f < sizeof(fixed) / sizeof(fixed[0]); f++)
+        {
+            struct abc_bench ab = {.fixed = fixed[f], .burst = bursts[b]};
+            ab.q = bq_make(malloc(QUEUE_SIZE), QUEUE_SIZE);
+            assert(ab.q.data);
+            abc_init(&ab.c, ABC_BUDGET_NS, ABC_MIN_BATCH, ABC_MAX_BATCH);
+
+            pthread_t prod;
+            pthread_create(&prod, NULL, abc_producer_thread, &ab);
+
+            uint64_t lat = 0, pops = 0;
+            for (size_t left = ABC_MSGS * ABC_MSG; left > 0;)
+            {
+                size_t count;
+                uint8_t *addr = bq_popbuf(&ab.q, &count);
+                count = ab.fixed ? MIN(count, ab.fixed) : abc_pop_len(&ab.c, count);
+                count -= count % ABC_MSG;
+                if (!count)
+                {
+                    if (!ab.fixed) abc_update(&ab.c, &ab.q, 0);
+                    sched_yield();
+                    continue;
+                }
+
+                uint64_t now = __rdtsc();
+                for (size_t i = 0; i < count; i += ABC_MSG)
+                    lat += now - *(uint64_t *)(addr + i);
+                bq_pop(&ab.q, count);
+                if (!ab.fixed) abc_update(&ab.c, &ab.q, count);
+                left -= count;
+                pops++;
+            }
+
+            pthread_join(prod, NULL);
+            char label[16];
+            snprintf(label, sizeof(label), ab.fixed ? "%zu" : "adaptive", ab.fixed);
+            double avg = lat / ticks_per_us / ABC_MSGS;
+            printf("%-12zu %-10s %14.1f %14.1f\n", ab.burst, label,
+                avg, (double)(ABC_MSGS * ABC_MSG) / pops);
+            free(ab.q.data);
+
+            if (ab.fixed) best = avg < best ? avg : best;
+            else assert(avg <= best * ABC_TOLERANCE + ABC_BUDGET_NS / 1000 * 0.05);
+        }
+    }
+}
+
+static void *abc_producer_thread(void *arg)
+{
+    struct abc_bench *ab = arg;
+    size_t pending = 0;
+
+    for (size_t i = 0; i < ABC_MSGS; i++)
+    {
+        if (i % ab->burst == 0)
+        {
+            // Idle between bursts: publish what is held first
+            bq_push(&ab->q, pending);
+            pending = 0;
+            usleep(ABC_BURST_SLEEP_USEC);
+        }
+
+        size_t len;
+        uint8_t *addr = bq_pushbuf(&ab->q, &len);
+        if (len < pending + ABC_MSG)
+        {
+            bq_push(&ab->q, pending);
+            pending = 0;
+            i--;
+            sched_yield();
+            continue;
+        }
+
+        *(uint64_t *)(addr + pending) = __rdtsc();
+        pending += ABC_MSG;
+
+        size_t batch = ab->fixed ? ab->fixed : abc_push_batch(&ab->c);
+        if (pending >= batch)
+        {
+            bq_push(&ab->q, pending);
+            pending = 0;
+        }
+    }
+
+    bq_push(&ab->q, pending);
+    return NULL;
+}
+
+static void dlq_run(void)
+{
+    printf("Running deadline drop test on %llu records\n", DLQ_RECORDS);
+
+    dlq d;
+    dlq_init(&d, malloc(QUEUE_SIZE), QUEUE_SIZE, malloc(QUEUE_SIZE), QUEUE_SIZE);
+    assert(d.data.data && d.index.data);
+
+    // Record i expires at i
+    for (uint64_t i = 0; i < DLQ_RECORDS; i++)
+    {
+        bqr_hdr *h = dlq_reserve(&d, sizeof(uint64_t) * (1 + i % 4));
+        assert(h);
+        h->type = 0;
+        *(uint64_t *)(h + 1) = i;
+        dlq_commit(&d, h, i);
+    }
+
+    size_t dropped;
+    TIME("DLQ drop expired")
+        dropped = dlq_drop_expired(&d, DLQ_RECORDS / 2);
+    assert(dropped == DLQ_RECORDS / 2 && d.dropped == dropped);
+    assert(dlq_drop_expired(&d, DLQ_RECORDS / 2) == 0);
+
+    uint64_t next = DLQ_RECORDS / 2;
+    for (bqr_hdr *h; (h = dlq_peek(&d)); next++)
+    {
+        assert(h->ts == next && *(uint64_t *)(h + 1) == next);
+        dlq_pop(&d);
+    }
+    assert(next == DLQ_RECORDS);
+
+    free(d.data.data);
+    free(d.index.data);
+}
+
+static void rpc_server_process(rpc_shm *shm)
+{
+    rpc_server s;
+    rpc_server_init(&s, &shm->req, &shm->rsp, RPC_BATCH);
+
+    for (;;)
+    {
+        bqr_hdr *req, *rsp;
+        if (!(req = rpc_serve(&s)) || !(rsp = rpc_reply_begin(&s, req, req->len)))
+        {
+            sched_yield();
+            continue;
+        }
+
+        memcpy(rsp + 1, req + 1, req->len);
+        uint16_t method = req->type;
+        rpc_reply_end(&s, req, rsp);
+        if (method == RPC_STOP) _exit(0);
+    }
+}
+
+/* Runs [rounds] echo calls on [c], with at most [depth] in flight */
+static void rpc_client_calls(rpc_client *c, size_t rounds, size_t depth)
+{
+    uint8_t msg[RPC_MSG];
+    size_t sent = 0, received = 0;
+    uint64_t first_id = c->next_id;
+
+    while (received < rounds)
+    {
+        bqr_hdr *h;
+        if (sent < rounds && sent - received < depth &&
+            (h = rpc_call_begin(c, RPC_ECHO, sizeof(msg))))
+        {
+            memset(msg, (uint8_t)sent, sizeof(msg));
+            memcpy(h + 1, msg, sizeof(msg));
+            rpc_call_end(c, h, (void *)(uintptr_t)sent);
+            sent++;
+            continue;
+        }
+
+        void *ctx;
+        if (!(h = rpc_recv(c, &ctx)))
+        {
+            sched_yield();
+            continue;
+        }
+
+        // The server is FIFO, so the responses come in order
+        assert(h->flags == RPC_REPLY && h->ts == first_id + received && (uintptr_t)ctx == received);
+        assert(((uint8_t *)(h + 1))[RPC_MSG - 1] == (uint8_t)received);
+        rpc_recv_done(c, h);
+        received++;
+    }
+}
+
+static size_t read_full(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+    for (ssize_t r; done < len && (r = read(fd, (char *)buf + done, len - done)) > 0; done += r);
+    return done;
+}
+
+static void rpc_run(void)
+{
+    printf("Running RPC test on %llu round trips of %d B\n", RPC_ROUNDS, RPC_MSG);
+    if (BQ_THREADING == BQ_SINGLE) return;
+    double ticks_per_ns = pace_tsc_per_ns();
+
+    rpc_shm *shm = rpc_shm_create(QUEUE_SIZE);
+    assert(shm);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (!pid) rpc_server_process(shm);
+
+    rpc_client c;
+    rpc_client_init(&c, &shm->req, &shm->rsp, RPC_BATCH);
+
+    uint64_t start = __rdtsc();
+    rpc_client_calls(&c, RPC_ROUNDS, 1);
+    printf("RPC over bq, 1 in flight: %.0f ns per call\n", (__rdtsc() - start) / ticks_per_ns / RPC_ROUNDS);
+
+    start = __rdtsc();
+    rpc_client_calls(&c, RPC_ROUNDS, RPC_PIPELINE);
+    printf("RPC over bq, %d in flight: %.0f ns per call\n", RPC_PIPELINE, (__rdtsc() - start) / ticks_per_ns / RPC_ROUNDS);
+
+    bqr_hdr *h;
+    while (!(h = rpc_call_begin(&c, RPC_STOP, 0)));
+    rpc_call_end(&c, h, NULL);
+    waitpid(pid, NULL, 0);
+    rpc_shm_free(shm);
+
+    // Baseline: the same echo over a Unix domain socket
+    int sv[2];
+    int r = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    assert(!r);
+    pid = fork();
+    assert(pid >= 0);
+    if (!pid)
+    {
+        close(sv[0]);
+        uint8_t msg[RPC_MSG];
+        while (read_full(sv[1], msg, sizeof(msg)) == sizeof(msg))
+            if (write(sv[1], msg, sizeof(msg)) != sizeof(msg)) break;
+        _exit(0);
+    }
+    close(sv[1]);
+
+    uint8_t msg[RPC_MSG];
+    start = __rdtsc();
+    for (size_t i = 0; i < RPC_ROUNDS; i++)
+    {
+        memset(msg, (uint8_t)i, sizeof(msg));
+        r = write(sv[0], msg, sizeof(msg));
+        assert(r == sizeof(msg));
+        r = read_full(sv[0], msg, sizeof(msg));
+        assert(r == sizeof(msg) && msg[RPC_MSG - 1] == (uint8_t)i);
+    }
+    printf("Unix domain socket, 1 in flight: %.0f ns per call\n", (__rdtsc() - start) / ticks_per_ns / RPC_ROUNDS);
+
+    close(sv[0]);
+    waitpid(pid, NULL, 0);
+}
+
+/* One side of a bidirectional channel between two processes: either a
+ * pair of file descriptors or a pair of byte queues in shared memory */
+struct ipc_end
+{
+    int rfd, wfd;
+    bq *rq, *wq;
+};
+
+static void ipc_send(struct ipc_end *e, const void *buf, size_t len)
+{
+    while (len > 0)
+    {
+        size_t count;
+        if (e->wq)
+        {
+            void *addr = bq_pushbuf(e->wq, &count);
+            count = MIN(count, len);
+            memcpy(addr, buf, count);
+            bq_push(e->wq, count);
+            if (!count) sched_yield();
+        }
+        else
+        {
+            ssize_t r = write(e->wfd, buf, len);
+            assert(r > 0);
+            count = r;
+        }
+        buf = (const char *)buf + count;
+        len -= count;
+    }
+}
+
+static void ipc_recv(struct ipc_end *e, void *buf, size_t len)
+{
+    if (!e->rq)
+    {
+        size_t r = read_full(e->rfd, buf, len);
+        assert(r == len);
+        return;
+    }
+
+    while (len > 0)
+    {
+        size_t count;
+        void *addr = bq_popbuf(e->rq, &count);
+        count = MIN(count, len);
+        memcpy(buf, addr, count);
+        bq_pop(e->rq, count);
+        if (!count) sched_yield();
+        buf = (char *)buf + count;
+        len -= count;
+    }
+}
+
+static void *ipc_make_pipe(struct ipc_end *parent, struct ipc_end *child)
+{
+    int down[2], up[2];
+    int r = pipe(down) | pipe(up);
+    assert(!r);
+    *parent = (struct ipc_end){.rfd = up[0], .wfd = down[1]};
+    *child = (struct ipc_end){.rfd = down[0], .wfd = up[1]};
+    return NULL;
+}
+
+static void *ipc_make_socketpair(struct ipc_end *parent, struct ipc_end *child, int type)
+{
+    int sv[2];
+    int r = socketpair(AF_UNIX, type, 0, sv);
+    assert(!r);
+    *parent = (struct ipc_end){.rfd = sv[0], .wfd = sv[0]};
+    *child = (struct ipc_end){.rfd = sv[1], .wfd = sv[1]};
+    return NULL;
+}
+
+static void *ipc_make_stream(struct ipc_end *parent, struct ipc_end *child)
+{
+    return ipc_make_socketpair(parent, child, SOCK_STREAM);
+}
+
+static void *ipc_make_seqpacket(struct ipc_end *parent, struct ipc_end *child)
+{
+    return ipc_make_socketpair(parent, child, SOCK_SEQPACKET);
+}
+
+static void *ipc_make_bq(struct ipc_end *parent, struct ipc_end *child)
+{
+    rpc_shm *shm = rpc_shm_create(QUEUE_SIZE);
+    assert(shm);
+    *parent = (struct ipc_end){.rfd = -1, .wfd = -1, .rq = &shm->rsp, .wq = &shm->req};
+    *child = (struct ipc_end){.rfd = -1, .wfd = -1, .rq = &shm->req, .wq = &shm->rsp};
+    return shm;
+}
+
+static void ipc_run(void)
+{
+    static const struct
+    {
+        const char *name;
+        void *(*make)(struct ipc_end *parent, struct ipc_end *child);
+    } backends[] = {
+        {"pipe", ipc_make_pipe},
+        {"unix stream", ipc_make_stream},
+        {"unix seqpacket", ipc_make_seqpacket},
+        {"shm bq", ipc_make_bq},
+    };
+
+    printf("Running IPC test on %llu messages of %d B and %llu round trips\n", IPC_MSGS, IPC_MSG, IPC_ROUNDS);
+    if (BQ_THREADING == BQ_SINGLE) return;
+    printf("%-16s %12s %16s\n", "backend", "MB/s", "ns/round trip");
+    double ticks_per_ns = pace_tsc_per_ns();
+
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++)
+    {
+        struct ipc_end parent, child;
+        void *shm = backends[b].make(&parent, &child);
+        uint8_t msg[IPC_MSG];
+
+        pid_t pid = fork();
+        assert(pid >= 0);
+        if (!pid)
+        {
+            // Throughput: receive everything, then acknowledge
+            for (size_t i = 0; i < IPC_MSGS; i++)
+            {
+                ipc_recv(&child, msg, sizeof(msg));
+                assert(msg[IPC_MSG - 1] == (uint8_t)i);
+            }
+            ipc_send(&child, msg, sizeof(msg));
+
+            // Latency: echo
+            for (size_t i = 0; i < IPC_ROUNDS; i++)
+            {
+                ipc_recv(&child, msg, sizeof(msg));
+                ipc_send(&child, msg, sizeof(msg));
+            }
+            _exit(0);
+        }
+
+        uint64_t start = __rdtsc();
+        for (size_t i = 0; i < IPC_MSGS; i++)
+        {
+            memset(msg, (uint8_t)i, sizeof(msg));
+            ipc_send(&parent, msg, sizeof(msg));
+        }
+        ipc_recv(&parent, msg, sizeof(msg));
+        double tput_ns = (__rdtsc() - start) / ticks_per_ns;
+
+        start = __rdtsc();
+        for (size_t i = 0; i < IPC_ROUNDS; i++)
+        {
+            memset(msg, (uint8_t)i, sizeof(msg));
+            ipc_send(&parent, msg, sizeof(msg));
+            ipc_recv(&parent, msg, sizeof(msg));
+            assert(msg[IPC_MSG - 1] == (uint8_t)i);
+        }
+        double rtt_ns = (__rdtsc() - start) / ticks_per_ns / IPC_ROUNDS;
+
+        waitpid(pid, NULL, 0);
+        printf("%-16s %12.1f %16.0f\n", backends[b].name,
+            IPC_MSGS * IPC_MSG / tput_ns * 1e9 / (1 << 20), rtt_ns);
+
+        if (shm) rpc_shm_free(shm);
+        else
+        {
+            close(parent.rfd);
+            close(child.rfd);
+            if (parent.wfd != parent.rfd) close(parent.wfd);
+            if (child.wfd != child.rfd) close(child.wfd);
+        }
+    }
+}
+
+static void bqf_run(void)
+{
+    printf("Running stdio test on %d rounds of %d lines and %d blocks of %d B\n", BQF_ROUNDS, BQF_LINES, BQF_BLOCKS, BQF_BLOCK);
+    bq q = bq_make(malloc(QUEUE_SIZE), QUEUE_SIZE);
+    assert(q.data);
+
+    FILE *w = bqf_open_writer(&q, BQF_BUFSIZE(&q));
+    FILE *r = bqf_open_reader(&q, BQF_BUFSIZE(&q));
+    FILE *wb = bqf_open_writer(&q, 0);
+    FILE *rb = bqf_open_reader(&q, 4096);
+    assert(w && r && wb && rb);
+
+    unsigned long long val = 0, expected = 0;
+    uint8_t block[BQF_BLOCK], check[BQF_BLOCK * BQF_BLOCKS];
+    for (size_t i = 0; i < BQF_ROUNDS; i++)
+    {
+        // Formatted, through the stdio buffers
+        TIME("BQF fprintf")
+        {
+            for (size_t j = 0; j < BQF_LINES; j++)
+                fprintf(w, "%llu\n", val++);
+            fflush(w);
+        }
+
+        TIME("BQF fscanf")
+        {
+            for (size_t j = 0; j < BQF_LINES; j++)
+            {
+                unsigned long long v;
+                int n = fscanf(r, "%llu", &v);
+                assert(n == 1 && v == expected++);
+                (void)n;
+            }
+        }
+
+        // The empty queue is end of file, until cleared
+        assert(fgetc(r) == '\n' && fgetc(r) == EOF && feof(r));
+        clearerr(r);
+
+        // Blocks, bigger than the stdio buffers: one copy each way
+        TIME("BQF fwrite unbuffered")
+        {
+            for (size_t j = 0; j < BQF_BLOCKS; j++)
+            {
+                memset(block, (uint8_t)(i + j), sizeof(block));
+                size_t n = fwrite(block, sizeof(block), 1, wb);
+                assert(n == 1);
+                (void)n;
+            }
+        }
+
+        TIME("BQF fread")
+        {
+            size_t n = fread(check, 1, sizeof(check), rb);
+            assert(n == sizeof(check));
+            (void)n;
+        }
+        for (size_t j = 0; j < sizeof(check); j++)
+            assert(check[j] == (uint8_t)(i + j / BQF_BLOCK));
+    }
+
+    assert(!ferror(w) && !ferror(r) && !ferror(wb) && !ferror(rb));
+    fclose(w);
+    fclose(r);
+    fclose(wb);
+    fclose(rb);
+    free(q.data);
+}
+
+static void *rba_alloc_(rba *a, size_t size)
+{
+    return a ? rba_alloc(a, size, 16) : malloc(size);
+}
+
+static void rba_free_(rba *a, void *p)
+{
+    if (a) rba_free(a, p);
+    else free(p);
+}
+
+static uint16_t rba_sizes[RBA_OPS];
+
+/* Allocates RBA_OPS blocks keeping RBA_WINDOW of them in use, freed in
+ * FIFO order except one in 8 swapped with the next one, with [a] or with
+ * malloc if NULL. Blocks are filled and checked to catch overlaps. */
+static void rba_pattern_(rba *a)
+{
+    struct { uint8_t *p; size_t len; } live[RBA_WINDOW];
+    size_t head = 0, count = 0;
+    for (size_t i = 0; i < RBA_OPS; i++)
+    {
+        if (count == RBA_WINDOW)
+        {
+            if (i % 8 == 0)
+            {
+                size_t next = (head + 1) % RBA_WINDOW;
+                __typeof__(live[0]) t = live[head];
+                live[head] = live[next];
+                live[next] = t;
+            }
+            uint8_t *p = live[head].p;
+            assert(p[0] == p[live[head].len - 1]);
+            rba_free_(a, p);
+            head = (head + 1) % RBA_WINDOW;
+            count--;
+        }
+
+        uint8_t *p = rba_alloc_(a, rba_sizes[i]);
+        assert(p);
+        p[0] = p[rba_sizes[i] - 1] = (uint8_t)i;
+        size_t slot = (head + count++) % RBA_WINDOW;
+        live[slot].p = p;
+        live[slot].len = rba_sizes[i];
+    }
+
+    while (count--)
+    {
+        rba_free_(a, live[head].p);
+        head = (head + 1) % RBA_WINDOW;
+    }
+}
+
+static rba rba_shared;
+static bq rba_handoff;
+
+static void rba_run(void)
+{
+    printf("Running ring allocator test on %llu blocks of up to %d B, %d in use\n", RBA_OPS, RBA_MAX_BLOCK, RBA_WINDOW);
+
+    rba a;
+    rba_init(&a, malloc(QUEUE_SIZE), QUEUE_SIZE);
+    assert(a.q.data);
+
+    for (size_t i = 0; i < RBA_OPS; i++)
+        rba_sizes[i] = 1 + rand() % RBA_MAX_BLOCK;
+
+    TIME("RBA alloc/free")
+        rba_pattern_(&a);
+    TIME("malloc/free")
+        rba_pattern_(NULL);
+
+    // Everything was freed, so the ring is empty
+    assert(a.q.head == a.q.tail);
+
+    // Aligned blocks, and the fallback when a block does not fit
+    void *p = rba_alloc(&a, 100, 4096), *q = rba_alloc(&a, QUEUE_SIZE, 16);
+    assert(p && !((uintptr_t)p & 4095) && rba_owns(&a, p) && !q);
+    assert(!rba_alloc(&a, 16, (size_t)RBA_FREED << 1) && !rba_alloc(&a, 16, QUEUE_SIZE << 1));
+    rba_free(&a, p);
+    free(a.q.data);
+
+    // The sizes of the blocks fit 31 bits, the buffer is not touched
+    rba_init(&a, (char *)(uintptr_t)RBA_ALIGN, 4ull << 30);
+    assert(a.q.mask + 1 == 1ull << 30);
+
+    if (BQ_THREADING == BQ_SINGLE) return;
+
+    // Allocated by one thread, freed by another
+    rba_init(&rba_shared, malloc(QUEUE_SIZE), QUEUE_SIZE);
+    rba_handoff = bq_make(malloc(QUEUE_SIZE), QUEUE_SIZE);
+    assert(rba_shared.q.data && rba_handoff.data);
+
+    pthread_t cons;
+    pthread_create(&cons, NULL, rba_consumer_thread, NULL);
+    for (size_t i = 0; i < RBA_OPS; i++)
+    {
+        size_t len = 1 + i % RBA_MAX_BLOCK;
+        uint8_t *p;
+        while (!(p = rba_alloc(&rba_shared, len, 16)))
+            sched_yield();
+        memset(p, (uint8_t)i, len);
+
+        size_t avail;
+        uint8_t **slot;
+        while ((slot = bq_pushbuf(&rba_handoff, &avail)), avail < sizeof(p))
+            sched_yield();
+        *slot = p;
+        bq_push(&rba_handoff, sizeof(p));
+    }
+    pthread_join(cons, NULL);
+
+    assert(rba_shared.q.head == rba_shared.q.tail);
+    free(rba_shared.q.data);
+    free(rba_handoff.data);
+}
+
+static void *rba_consumer_thread(void *arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < RBA_OPS;)
+    {
+        size_t avail;
+        uint8_t **slot = bq_popbuf(&rba_handoff, &avail);
+        if (avail < sizeof(*slot))
+        {
+            sched_yield();
+            continue;
+        }
+
+        uint8_t *p = *slot;
+        bq_pop(&rba_handoff, sizeof(p));
+        size_t len = 1 + i % RBA_MAX_BLOCK;
+        assert(p[0] == (uint8_t)i && p[len - 1] == (uint8_t)i);
+        rba_free(&rba_shared, p);
+        i++;
+    }
+    return NULL;
+}
+
+typedef struct
+{
+    uint64_t seq;
+    uint64_t end;
+} txq_desc;
+
+static bq txq_data, txq_index;
+static txq_group txq_pair;
+
+static void txq_run(void)
+{
+    printf("Running multi-queue commit test on %llu messages of %d B\n", TXQ_MSGS, TXQ_MSG);
+
+    // An aborted reservation leaves nothing behind
+    char buf[256];
+    bq q = bq_make(buf, sizeof(buf));
+    txq_rsv r;
+    int err = txq_reserve(&r, &q, TXQ_MSG);
+    assert(!err && r.len == sizeof(buf) && r.buf == buf);
+    memset(r.buf, 0xff, TXQ_MSG);
+    txq_abort(&r);
+    assert(q.tail == 0 && !r.buf);
+    err = txq_reserve(&r, &q, sizeof(buf) + 1);
+    assert(err && !r.buf);
+    err = txq_reserve(&r, &q, TXQ_MSG);
+    assert(!err);
+    txq_push(&r, TXQ_MSG);
+    assert(q.tail == TXQ_MSG && !r.buf);
+    (void)err;
+
+    if (BQ_THREADING == BQ_SINGLE) return;
+
+    txq_data = bq_make(malloc(QUEUE_SIZE), QUEUE_SIZE);
+    txq_index = bq_make(malloc(QUEUE_SIZE / 4), QUEUE_SIZE / 4);
+    assert(txq_data.data && txq_index.data);
+    bq *queues[] = {&txq_data, &txq_index};
+    txq_group_init(&txq_pair, queues, 2);
+
+    pthread_t prod;
+    pthread_create(&prod, NULL, txq_producer_thread, NULL);
+
+    size_t tails[2];
+    uint64_t expected = 0, last_epoch = 0;
+    while (expected < TXQ_MSGS)
+    {
+        uint64_t epoch;
+        TIME("TXQ snapshot")
+            epoch = txq_snapshot(&txq_pair, tails);
+        assert(epoch >= last_epoch);
+        last_epoch = epoch;
+
+        size_t len;
+        txq_desc *d = txq_popbuf(&txq_index, tails[1], &len);
+        if (!len)
+        {
+            sched_yield();
+            continue;
+        }
+
+        for (size_t n = 0; n < len / sizeof(*d); n++, d++)
+        {
+            // The index is committed before the data, in the same epoch:
+            // the data of every visible descriptor is visible too
+            assert(d->seq == expected && d->end - txq_data.head == TXQ_MSG);
+            assert((int64_t)(tails[0] - d->end) >= 0);
+
+            size_t dlen;
+            uint8_t *msg = txq_popbuf(&txq_data, tails[0], &dlen);
+            assert(dlen >= TXQ_MSG && msg[0] == (uint8_t)expected && msg[TXQ_MSG - 1] == (uint8_t)expected);
+            bq_pop(&txq_data, TXQ_MSG);
+            expected++;
+        }
+        bq_pop(&txq_index, len - len % sizeof(*d));
+    }
+
+    pthread_join(prod, NULL);
+    free(txq_data.data);
+    free(txq_index.data);
+}
+
+static void *txq_producer_thread(void *arg)
+{
+    (void)arg;
+    uint64_t seq = 0;
+    for (uint64_t i = 0; seq < TXQ_MSGS; i++)
+    {
+        txq_rsv r[2];
+        if (txq_reserve(r, &txq_index, sizeof(txq_desc)) ||
+            txq_reserve(r + 1, &txq_data, TXQ_MSG))
+        {
+            txq_abort(r);
+            sched_yield();
+            continue;
+        }
+
+        memset(r[1].buf, (uint8_t)seq, TXQ_MSG);
+        txq_desc *d = (txq_desc *)r[0].buf;
+        d->seq = seq;
+        d->end = txq_data.tail + TXQ_MSG;
+
+        // Something went wrong halfway: nothing is published
+        if (i % TXQ_ABORT_EVERY == 0)
+        {
+            txq_abort(r);
+            txq_abort(r + 1);
+            continue;
+        }
+
+        static const size_t counts[] = {sizeof(txq_desc), TXQ_MSG};
+        TIME("TXQ commit")
+            txq_commit(&txq_pair, r, counts, 2);
+        seq++;
+    }
+    return NULL;
+}
+
+// Differs from the byte one queue capacity before, so that a torn copy
+// can not go unnoticed
+static uint8_t tap_byte(size_t i)
+{
+    return (uint8_t)(i + i / TAP_QUEUE_SIZE);
+}
+
+static bq tap_queue;
+
+static void tap_run(void)
+{
+    printf("Running tap test on %llu MB\n", TAP_BYTES >> 20);
+
+    char buf[256], out[256];
+    bq q = bq_make(buf, sizeof(buf));
+    tap t;
+    tap_init(&t, &q);
+    size_t len, gap;
+    char *p = bq_pushbuf(&q, &len);
+    for (size_t i = 0; i < 100; i++)
+        p[i] = tap_byte(i);
+    bq_push(&q, 100);
+
+    // The tap reads behind the consumer, without moving it
+    len = tap_read(&t, out, 64, &gap);
+    assert(len == 64 && !gap && !memcmp(out, buf, 64) && q.head == 0);
+    bq_pop(&q, 80);
+    len = tap_read(&t, out, sizeof(out), &gap);
+    assert(len == 20 && gap == 16 && out[0] == (char)tap_byte(80));
+    assert(t.gaps == 1 && t.lost == 16);
+
+    // A full queue, across the end of the buffer
+    bq_pop(&q, 20);
+    for (size_t i = 100; i < 356; i++)
+        buf[i % sizeof(buf)] = tap_byte(i);
+    bq_push(&q, 256);
+    len = tap_read(&t, out, sizeof(out), &gap);
+    assert(len == 256 && !gap && out[0] == (char)tap_byte(100) && out[255] == (char)tap_byte(355));
+    len = tap_read(&t, out, sizeof(out), &gap);
+    assert(!len && !gap && t.pos == q.tail);
+    (void)len;
+
+    if (BQ_THREADING == BQ_SINGLE) return;
+
+    // The tap runs on a third thread, next to a producer and a consumer
+    tap_queue = bq_make(malloc(TAP_QUEUE_SIZE), TAP_QUEUE_SIZE);
+    assert(tap_queue.data);
+    tap_init(&t, &tap_queue);
+
+    pthread_t prod, cons;
+    pthread_create(&prod, NULL, tap_producer_thread, NULL);
+    pthread_create(&cons, NULL, tap_consumer_thread, NULL);
+
+    size_t seen = 0;
+    while (t.pos < TAP_BYTES)
+    {
+        TIME("TAP read")
+            len = tap_read(&t, out, sizeof(out), &gap);
+        // Nothing past what the producer committed
+        assert((ptrdiff_t)(bq_load_(&tap_queue.tail) - t.pos) >= 0);
+        for (size_t i = 0; i < len; i++)
+            assert(out[i] == (char)tap_byte(t.pos - len + i));
+        seen += len;
+        if (!len) sched_yield();
+    }
+    assert(seen + t.lost == TAP_BYTES);
+    printf("Tap saw %zu of %llu bytes, %llu gaps\n", seen, TAP_BYTES,
+        (unsigned long long)t.gaps);
+
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+    free(tap_queue.data);
+}
+
+static void *tap_producer_thread(void *arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < TAP_BYTES;)
+    {
+        size_t len;
+        char *p = bq_pushbuf(&tap_queue, &len);
+        if (!len)
+        {
+            sched_yield();
+            continue;
+        }
+
+        size_t max = 1 + rand() % TAP_MAX_CHUNK;
+        len = len < max ? len : max;
+        len = len < TAP_BYTES - i ? len : TAP_BYTES - i;
+        for (size_t j = 0; j < len; j++)
+            p[j] = tap_byte(i + j);
+        bq_push(&tap_queue, len);
+        i += len;
+    }
+    return NULL;
+}
+
+static void *tap_consumer_thread(void *arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < TAP_BYTES;)
+    {
+        size_t len;
+        char *p = bq_popbuf(&tap_queue, &len);
+        if (!len)
+        {
+            sched_yield();
+            continue;
+        }
 
-#include "others/bbq.h"
-#include "others/vbq.h"
-#include "others/abq.h"
-#include "others/lfq.h"
+        // A consumer slower than the tap, most of the time
+        len = len < TAP_MAX_CHUNK ? len : TAP_MAX_CHUNK;
+        assert(p[0] == (char)tap_byte(i) && p[len - 1] == (char)tap_byte(i + len - 1));
+        bq_pop(&tap_queue, len);
+        i += len;
+        sched_yield();
+    }
+    return NULL;
+}
 
-#include "bq.h"
-#include "profiler.h"
+static void lzb_fill_log(uint8_t *buf, size_t len)
+{
+    static const char *levels[] = {"INFO", "INFO", "INFO", "WARN", "DEBUG"};
+    for (size_t off = 0, i = 0; off < len; i++)
+    {
+        char line[160];
+        int n = snprintf(line, sizeof(line),
+            "2025-06-01T12:%02zu:%02zu.%06u %s worker-%u: request id=%zu bytes=%u status=ok\n",
+            i / 3600 % 60, i / 60 % 60, rand() % 1000000, levels[rand() % 5],
+            rand() % 8, 1000000 + i, rand() % 65536);
+        n = (size_t)n < len - off ? n : (int)(len - off);
+        memcpy(buf + off, line, n);
+        off += n;
+    }
+}
 
-#define BYTES_TO_PRODUCE    1024*1024*1024ull
-#define QUEUE_SIZE          1024*1024ull
-#define MAX_BYTES_PER_OP    1024ull
-#define MAX_SLEEP_USEC      50
+static void lzb_fill_telemetry(uint8_t *buf, size_t len)
+{
+    struct
+    {
+        uint64_t seq, ts;
+        uint32_t sensor, flags;
+        double value;
+    } r = {.ts = 1700000000000000000ull};
+    for (size_t off = 0; off < len; off += sizeof(r))
+    {
+        r.seq++;
+        r.ts += 1000 + rand() % 16;
+        r.sensor = rand() % 16;
+        r.value = 20 + (rand() % 100) / 10.0;
+        memcpy(buf + off, &r, sizeof(r) < len - off ? sizeof(r) : len - off);
+    }
+}
 
-static void *producer_thread(void *arg);
-static void *consumer_thread(void *arg);
+static void lzb_fill_random(uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        buf[i] = rand();
+}
 
-static bbq bbq_queue;
-static vbq vbq_queue;
-static abq abq_queue;
-static lfq lfq_queue;
-static bq bq_queue;
+static void lzb_run(void)
+{
+    static const struct
+    {
+        const char *name;
+        void (*fill)(uint8_t *buf, size_t len);
+    } payloads[] = {
+        {"log lines", lzb_fill_log},
+        {"telemetry", lzb_fill_telemetry},
+        {"random", lzb_fill_random},
+    };
 
-static bool prod_finished;
+    printf("Running LZ block test on %llu records and %d KB blocks\n", LZB_RECORDS, LZB_MAX_BLOCK >> 10);
+    static lzb z;
+    static uint8_t raw[LZB_MAX_BLOCK], packed[LZB_MAX_BLOCK], out[LZB_MAX_BLOCK + 16];
 
-int main()
+    // Round trips, including overlapping matches and incompressible data
+    memset(raw, 'a', sizeof(raw));
+    size_t size = lzb_compress(&z, packed, sizeof(packed), raw, sizeof(raw));
+    assert(size && size < 300);
+    assert(!lzb_decompress(out, sizeof(raw), packed, size) && !memcmp(out, raw, sizeof(raw)));
+    assert(lzb_decompress(out, sizeof(raw) - 1, packed, size) == -1);
+    size = lzb_compress(&z, packed, sizeof(packed), raw, 0);
+    assert(size == 1 && !lzb_decompress(out, 0, packed, size));
+    lzb_fill_random(raw, sizeof(raw));
+    assert(!lzb_compress(&z, packed, sizeof(raw), raw, sizeof(raw)));
+
+    // Corrupted input fails or decodes to garbage, within bounds
+    lzb_fill_log(raw, sizeof(raw));
+    size = lzb_compress(&z, packed, sizeof(packed), raw, sizeof(raw));
+    assert(size && !lzb_decompress(out, sizeof(raw), packed, size) && !memcmp(out, raw, sizeof(raw)));
+    assert(lzb_decompress(out, sizeof(raw), packed, size - 1) == -1);
+    for (int i = 0; i < 1024; i++)
+    {
+        size_t at = rand() % size;
+        uint8_t old = packed[at];
+        packed[at] ^= 1 + rand() % 255;
+        out[sizeof(raw)] = 0x5a;
+        lzb_decompress(out, sizeof(raw), packed, size);
+        assert(out[sizeof(raw)] == 0x5a);
+        packed[at] = old;
+    }
+
+    // The stage: records through pack and unpack, in three queues
+    bq q[3];
+    for (int i = 0; i < 3; i++)
+    {
+        q[i] = bq_make(malloc(QUEUE_SIZE / 4), QUEUE_SIZE / 4);
+        assert(q[i].data);
+    }
+    uint64_t pushed = 0, popped = 0, raw_bytes = 0, packed_bytes = 0;
+    while (popped < LZB_RECORDS)
+    {
+        for (bqr_hdr *h; pushed < LZB_RECORDS && (h = bqr_reserve(&q[0], 16 + rand() % LZB_MAX_RECORD)); pushed++)
+        {
+            h->type = pushed % 3;
+            h->ts = pushed;
+            payloads[h->type].fill((uint8_t *)(h + 1), h->len);
+            bqr_commit(&q[0], h);
+        }
+
+        for (size_t n; (n = lzb_pack(&z, &q[0], &q[1]));)
+        {
+            raw_bytes += n;
+            packed_bytes = q[1].tail;
+        }
+
+        for (ptrdiff_t n; (n = lzb_unpack(&q[1], &q[2]));)
+            assert(n > 0);
+
+        size_t off = 0;
+        for (bqr_hdr *h; (h = bqr_peek(&q[2], &off)); off += BQR_SIZE(h->len), popped++)
+        {
+            assert(h->ts == popped && h->type == popped % 3 && h->len >= 16);
+        }
+        bq_pop(&q[2], off);
+    }
+    assert(pushed == popped && !lzb_pack(&z, &q[0], &q[1]) && !lzb_unpack(&q[1], &q[2]));
+
+    // A corrupted record is dropped, the next one goes through
+    for (int i = 0; i < 2; i++)
+    {
+        bqr_hdr *h = bqr_reserve(&q[0], 64);
+        assert(h);
+        h->type = 0;
+        h->ts = i;
+        memset(h + 1, i, 64);
+        bqr_commit(&q[0], h);
+        assert(lzb_pack(&z, &q[0], &q[1]) == BQR_SIZE(64));
+    }
+    size_t off = 0;
+    bqr_hdr *bad = bqr_peek(&q[1], &off);
+    // The raw size does not match what the data decompresses to
+    uint64_t raw_size;
+    memcpy(&raw_size, bad + 1, sizeof(raw_size));
+    raw_size += 16;
+    memcpy(bad + 1, &raw_size, sizeof(raw_size));
+    assert(lzb_unpack(&q[1], &q[2]) == -1 && q[2].tail == q[2].head);
+    assert(lzb_unpack(&q[1], &q[2]) == BQR_SIZE(64) && !lzb_unpack(&q[1], &q[2]));
+    off = 0;
+    assert(bqr_peek(&q[2], &off)->ts == 1);
+    printf("Stage packed %lu KB of records to %lu KB\n", raw_bytes >> 10, packed_bytes >> 10);
+    for (int i = 0; i < 3; i++)
+        free(q[i].data);
+
+    printf("%-12s %8s %16s %16s\n", "payload", "ratio", "compress GB/s", "decompress GB/s");
+    double ticks_per_ns = pace_tsc_per_ns();
+    for (size_t p = 0; p < sizeof(payloads) / sizeof(payloads[0]); p++)
+    {
+        payloads[p].fill(raw, sizeof(raw));
+        uint64_t start = __rdtsc();
+        for (int i = 0; i < LZB_BENCH_ROUNDS; i++)
+        {
+            TIME("LZB compress")
+                size = lzb_compress(&z, packed, sizeof(packed), raw, sizeof(raw));
+        }
+        double compress_ns = (__rdtsc() - start) / ticks_per_ns;
+
+        // Incompressible blocks are stored as they are
+        double ratio = size ? (double)sizeof(raw) / size : 1;
+        double decompress_ns = 0;
+        if (size)
+        {
+            start = __rdtsc();
+            for (int i = 0; i < LZB_BENCH_ROUNDS; i++)
+            {
+                TIME("LZB decompress")
+                    lzb_decompress(out, sizeof(raw), packed, size);
+            }
+            decompress_ns = (__rdtsc() - start) / ticks_per_ns;
+            assert(!memcmp(out, raw, sizeof(raw)));
+        }
+
+        double bytes = (double)sizeof(raw) * LZB_BENCH_ROUNDS;
+        printf("%-12s %8.2f %16.2f ", payloads[p].name, ratio, bytes / compress_ns);
+        if (size) printf("%16.2f\n", bytes / decompress_ns);
+        else printf("%16s\n", "stored");
+    }
+}
+
+static void svb_run(void)
 {
-    srand(time(NULL));
-    prod_finished = false;
+    printf("Running varint codec test on %d columns of %llu values\n", SVB_COLUMNS, SVB_VALUES);
 
-    bbq_queue_init(&bbq_queue, malloc(QUEUE_SIZE), QUEUE_SIZE);
-    vbq_queue_init(&vbq_queue, malloc(QUEUE_SIZE), QUEUE_SIZE);
-    abq_queue_init(&abq_queue, malloc(QUEUE_SIZE), QUEUE_SIZE);
-    lfq_queue_init(&lfq_queue, malloc(QUEUE_SIZE), QUEUE_SIZE);
-    bq_queue = bq_make(malloc(QUEUE_SIZE), QUEUE_SIZE);
+    // Sequence numbers, timestamps, small ids and anything at all
+    uint64_t *cols[SVB_COLUMNS];
+    for (int c = 0; c < SVB_COLUMNS; c++)
+    {
+        cols[c] = malloc(SVB_VALUES * sizeof(uint64_t));
+        assert(cols[c]);
+    }
+    uint64_t ts = 1700000000000000000ull;
+    for (size_t i = 0; i < SVB_VALUES; i++)
+    {
+        cols[0][i] = 1000 + i;
+        cols[1][i] = ts += 1000 + rand() % 64;
+        cols[2][i] = rand() % 100;
+        cols[3][i] = (uint64_t)rand() << 33 ^ (uint64_t)rand() << 11 ^ rand();
+    }
 
-    assert(bbq_queue.data && vbq_queue.data &&
-        abq_queue.data && lfq_queue.data && bq_queue.data);
+    bq q = bq_make(malloc(QUEUE_SIZE / 16), QUEUE_SIZE / 16);
+    assert(q.data);
+    uint64_t enc_prev[SVB_COLUMNS] = {0}, dec_prev[SVB_COLUMNS] = {0}, scalar_prev[SVB_COLUMNS] = {0};
+    size_t pushed[SVB_COLUMNS] = {0}, popped[SVB_COLUMNS] = {0}, encoded[SVB_COLUMNS] = {0};
+    static uint64_t v[SVB_MAX_FRAME], scalar[SVB_MAX_FRAME];
 
-    printf("Running test on moving %llu MB, queues of %llu MB, max %llu B per operation\n", BYTES_TO_PRODUCE >> 20, QUEUE_SIZE >> 20, MAX_BYTES_PER_OP);
-    pthread_t prod, cons;
-    pthread_create(&prod, NULL, producer_thread, NULL);
-    pthread_create(&cons, NULL, consumer_thread, NULL);
+    for (int done = 0; done < SVB_COLUMNS;)
+    {
+        for (int c = 0; c < SVB_COLUMNS; c++)
+        {
+            size_t n = 1 + rand() % (2 * SVB_MAX_FRAME);
+            n = n < SVB_VALUES - pushed[c] ? n : SVB_VALUES - pushed[c];
+            if (!n) continue;
+            size_t tail = q.tail;
+            pushed[c] += svb_push(&q, c, cols[c] + pushed[c], n, enc_prev + c);
+            encoded[c] += q.tail - tail;
+        }
 
-    pthread_join(prod, NULL);
-    pthread_join(cons, NULL);
-    
-    free(bbq_queue.data);
-    free(vbq_queue.data);
-    free(abq_queue.data);
-    free(lfq_queue.data);
-    free(bq_queue.data);
-    bbq_queue_free(&bbq_queue);
-    vbq_queue_free(&vbq_queue);
-    abq_queue_free(&abq_queue);
+        size_t off = 0;
+        for (bqr_hdr *h; (h = bqr_peek(&q, &off)); off += BQR_SIZE(h->len))
+        {
+            int c = h->flags, n, m;
+            TIME("SVB decode")
+                n = svb_decode(h, v, dec_prev + c);
+            TIME("SVB decode scalar")
+                m = svb_decode_(h, scalar, scalar_prev + c, 0);
+            assert(n > 0 && m == n);
+            assert(!memcmp(v, cols[c] + popped[c], n * sizeof(*v)));
+            assert(!memcmp(scalar, v, n * sizeof(*v)) && scalar_prev[c] == dec_prev[c]);
+            popped[c] += n;
+            if (popped[c] == SVB_VALUES) done++;
+        }
+        bq_pop(&q, off);
+    }
 
-    puts("Test ended without errors");
+    // A frame that lies about its length
+    uint64_t one = 1, prev = 0;
+    size_t n = svb_push(&q, 0, &one, 1, &prev);
+    size_t off = 0;
+    bqr_hdr *h = bqr_peek(&q, &off);
+    assert(n == 1 && h);
+    h->len--;
+    assert(svb_decode(h, v, &prev) == -1);
+    (void)n;
 
-    prf_output_measures(stdout);
+    static const char *names[SVB_COLUMNS] = {"sequence", "timestamp", "id", "random"};
+    for (int c = 0; c < SVB_COLUMNS; c++)
+        printf("%-10s %llu KB encoded to %zu KB with frames, ratio %.2f\n", names[c],
+            SVB_VALUES * 8 >> 10, encoded[c] >> 10, (double)(SVB_VALUES * 8) / encoded[c]);
+    free(q.data);
+    for (int c = 0; c < SVB_COLUMNS; c++)
+        free(cols[c]);
+}
+
+typedef struct
+{
+    uint64_t ts;
+    uint32_t id;
+    float price;
+    uint16_t qty;
+    uint8_t side;
+} cbf_tick;
+
+static void cbf_make_tick(cbf_tick *t, size_t i)
+{
+    *t = (cbf_tick){.ts = 1000 * i, .id = i % 64, .price = 100 + i % 50,
+        .qty = 1 + i % 100, .side = i & 1};
+}
+
+static void cbf_run(void)
+{
+    static const cbf_field fields[] = {
+        CBF_FIELD(cbf_tick, ts),
+        CBF_FIELD(cbf_tick, id),
+        CBF_FIELD(cbf_tick, price),
+        CBF_FIELD(cbf_tick, qty),
+        CBF_FIELD(cbf_tick, side),
+    };
+    static const cbf_schema schema = {fields, 5, CBF_ROWS};
+    static const cbf_schema fewer = {fields, 4, CBF_ROWS};
+
+    printf("Running columnar batch test on %llu rows, %d per batch\n", CBF_TICKS, CBF_ROWS);
+    bq q = bq_make(malloc(QUEUE_SIZE), QUEUE_SIZE);
+    assert(q.data);
+
+    // Columns: the consumer loops over arrays
+    double expected = 0, notional = 0;
+    uint64_t rows = 0, buys = 0;
+    for (size_t i = 0; i < CBF_TICKS;)
+    {
+        cbf_batch b;
+        int err = cbf_begin(&b, &q, &schema);
+        assert(!err);
+        // The last batch is committed partial
+        for (cbf_tick t; i < CBF_TICKS && (cbf_make_tick(&t, i), !cbf_append(&b, &t)); i++)
+            expected += t.price * t.qty;
+        int partial = b.rows < schema.rows;
+        cbf_commit(&q, &b);
+        for (unsigned c = 0; c < schema.n; c++)
+            assert((uintptr_t)b.col[c] % CBF_ALIGN == 0);
+        // A partial batch ends with its last row
+        assert(!partial || (uintptr_t)(b.h + 1) + b.h->len ==
+            (uintptr_t)b.col[schema.n - 1] + (size_t)b.rows * fields[schema.n - 1].width);
+
+        size_t off = 0;
+        for (bqr_hdr *h; (h = bqr_peek(&q, &off)); off += BQR_SIZE(h->len))
+        {
+            cbf_view v;
+            err = cbf_read(h, &schema, &v);
+            assert(!err && cbf_read(h, &fewer, &v) == -1);
+            // One row more than the record holds reaches past its end
+            ((cbf_hdr_ *)(h + 1))->rows++;
+            assert(cbf_read(h, &schema, &v) == -1);
+            ((cbf_hdr_ *)(h + 1))->rows--;
+            err = cbf_read(h, &schema, &v);
+            TIME("CBF consume columns")
+            {
+                const float *price = CBF_COL(&v, 2, const float);
+                const uint16_t *qty = CBF_COL(&v, 3, const uint16_t);
+                const uint8_t *side = CBF_COL(&v, 4, const uint8_t);
+                for (uint32_t r = 0; r < v.rows; r++)
+                {
+                    notional += price[r] * qty[r];
+                    buys += side[r];
+                }
+            }
+            assert(CBF_COL(&v, 0, const uint64_t)[0] == 1000 * rows);
+            rows += v.rows;
+        }
+        bq_pop(&q, off);
+        (void)err;
+    }
+    assert(rows == CBF_TICKS && buys == CBF_TICKS / 2 && notional == expected);
+
+    // Rows: the same sums over one record per row
+    notional = 0;
+    for (size_t i = 0; i < CBF_TICKS;)
+    {
+        bqr_hdr *h;
+        for (size_t n = 0; n < CBF_ROWS && i < CBF_TICKS && (h = bqr_reserve(&q, sizeof(cbf_tick))); n++, i++)
+        {
+            h->type = 0;
+            cbf_make_tick((cbf_tick *)(h + 1), i);
+            bqr_commit(&q, h);
+        }
 
+        size_t off = 0;
+        TIME("CBF consume rows")
+        {
+            for (bqr_hdr *h; (h = bqr_peek(&q, &off)); off += BQR_SIZE(h->len))
+            {
+                const cbf_tick *t = (const cbf_tick *)(h + 1);
+                notional += t->price * t->qty;
+            }
+        }
+        bq_pop(&q, off);
+    }
+    assert(notional == expected);
+    free(q.data);
+}
+
+// Writes the field [f] of the message [i]
+static int cur_put_field(cur *w, uint64_t i, int f)
+{
+    uint8_t str[CUR_MAX_STR];
+    switch (f)
+    {
+    case 0: return cur_put_varint(w, i);
+    case 1: return cur_put_u32(w, i * 7);
+    case 2: return cur_put_u64(w, i * i);
+    case 3: return cur_put_varint(w, i % CUR_MAX_STR);
+    default:
+        memset(str, (uint8_t)i, i % CUR_MAX_STR);
+        return cur_put_bytes(w, str, i % CUR_MAX_STR);
+    }
+}
+
+// Reads a whole message, or nothing
+static int cur_get_msg(cur *r, uint64_t *id)
+{
+    size_t mark = cur_mark(r);
+    uint32_t u32;
+    uint64_t u64, len;
+    uint8_t str[CUR_MAX_STR];
+    int err = cur_get_varint(r, id);
+    if (!err) err = cur_get_u32(r, &u32);
+    if (!err) err = cur_get_u64(r, &u64);
+    if (!err) err = cur_get_varint(r, &len);
+    if (!err)
+    {
+        assert(len < CUR_MAX_STR);
+        const uint8_t *p = cur_get_view(r, len);
+        if (!p && !(err = cur_get_bytes(r, str, len))) p = str;
+        if (p) assert(!len || (p[0] == (uint8_t)*id && p[len - 1] == (uint8_t)*id));
+    }
+    if (err)
+    {
+        cur_rewind(r, mark);
+        return err;
+    }
+    assert(u32 == (uint32_t)(*id * 7) && u64 == *id * *id && len == *id % CUR_MAX_STR);
+    return 0;
+}
+
+static void cur_run(void)
+{
+    printf("Running cursor test on %llu messages\n", CUR_MSGS);
+
+    // A small queue, so that fields are split by the end of the buffer
+    // and messages by the producer
+    char buf[256];
+    bq q = bq_make(buf, sizeof(buf));
+    cur w, r;
+    uint64_t sent = 0, received = 0, more = 0;
+    int field = 0;
+
+    while (received < CUR_MSGS)
+    {
+        cur_writer(&w, &q);
+        while (sent < CUR_MSGS && !cur_put_field(&w, sent, field))
+        {
+            field = (field + 1) % 5;
+            if (!field) sent++;
+            if (rand() % 8 == 0) break;
+        }
+        cur_push(&w);
+
+        cur_reader(&r, &q);
+        for (uint64_t id; received < CUR_MSGS; received++)
+        {
+            int err;
+            TIME("CUR message")
+                err = cur_get_msg(&r, &id);
+            if (err)
+            {
+                assert(err == CUR_MORE);
+                more++;
+                break;
+            }
+            assert(id == received);
+        }
+        cur_pop(&r);
+    }
+    assert(q.head == q.tail);
+
+    // Varints longer than 10 bytes, in one span and split
+    for (size_t at = 0; at < sizeof(buf); at += sizeof(buf) - 4)
+    {
+        q.head = q.tail = at;
+        cur_writer(&w, &q);
+        for (int i = 0; i < CUR_VARINT + 1; i++)
+            cur_put_u8(&w, 0x80);
+        cur_put_u8(&w, 0);
+        cur_push(&w);
+
+        uint64_t v;
+        cur_reader(&r, &q);
+        assert(cur_get_varint(&r, &v) == CUR_BAD && cur_mark(&r) == at && cur_left(&r) == CUR_VARINT + 2);
+        q.tail -= 3;
+        cur_reader(&r, &q);
+        assert(cur_get_varint(&r, &v) == CUR_MORE && cur_mark(&r) == at);
+        (void)v;
+    }
+    printf("Messages incomplete at the first try: %llu\n", (unsigned long long)more);
+}
+
+typedef struct
+{
+    uint64_t next, sum;
+    bool stopped;
+} bus_sink;
+
+static int bus_handle(void *ctx, const bqr_hdr *h, void *payload)
+{
+    bus_sink *s = ctx;
+    const uint64_t *p = payload;
+    assert(p[0] == s->next && h->len == 8u * (1 + h->type % BUS_TYPES));
+    s->next++;
+    s->sum += p[h->len / 8 - 1];
     return 0;
 }
 
+// Stops the batch once before each record
+static int bus_handle_slow(void *ctx, const bqr_hdr *h, void *payload)
+{
+    bus_sink *s = ctx;
+    s->stopped = !s->stopped;
+    return s->stopped ? BUS_STOP : bus_handle(ctx, h, payload);
+}
+
+static void bus_run(void)
+{
+    printf("Running message bus test on %llu messages of %d types\n", BUS_MSGS, BUS_TYPES + 2);
+    static bus b;
+    bus_sink sink = {0};
+    bus_init(&b);
+    for (unsigned t = 0; t < BUS_TYPES; t++)
+        bus_on(&b, t, t == 3 ? bus_handle_slow : bus_handle, &sink);
+    bus_on(&b, BUS_OTHER, bus_handle, &sink);
+
+    // Type BUS_TYPES has no handler, 300 is out of the table
+    static const uint16_t types[] = {0, 1, 2, 3, 4, 5, 6, 7, BUS_TYPES, 300};
+    bq q = bq_make(malloc(QUEUE_SIZE / 16), QUEUE_SIZE / 16);
+    assert(q.data);
+    uint64_t sent = 0, expected = 0, handled = 0;
+    while (handled < BUS_MSGS)
+    {
+        for (uint64_t *p; sent < BUS_MSGS; sent++)
+        {
+            uint16_t type = types[sent % 10];
+            size_t words = 1 + type % BUS_TYPES;
+            if (!(p = bus_reserve(&q, type, 8 * words))) break;
+            p[0] = sent;
+            p[words - 1] = sent;
+            expected += sent;
+            bus_commit(&q, p);
+        }
+
+        size_t n;
+        TIME("BUS dispatch batch")
+            n = bus_dispatch(&b, &q, BUS_BATCH);
+        handled += n;
+    }
+    assert(sink.next == BUS_MSGS && sink.sum == expected && q.head == q.tail);
+
+    printf("%-8s %10s %10s %14s\n", "type", "calls", "KB", "cycles/call");
+    for (unsigned t = 0; t <= BUS_MAX_TYPES; t++)
+    {
+        bus_stats *s = b.stats + t;
+        if (!s->calls) continue;
+        printf("%-8u %10lu %10lu %14.1f\n", t, s->calls, s->bytes >> 10, (double)s->cycles / s->calls);
+    }
+    assert(b.stats[3].calls == BUS_MSGS / 10 && b.stats[BUS_OTHER].calls == BUS_MSGS / 5);
+    free(q.data);
+}
+
+typedef struct
+{
+    uint64_t seq, val;
+} pln_msg;
+
+typedef struct
+{
+    uint64_t next, end, mult;
+} pln_counter;
+
+// Sends consecutive messages to its outputs in turn, up to [end]
+static long pln_source(pln_stage *s)
+{
+    pln_counter *c = s->ctx;
+    if (c->next == c->end) return PLN_DONE;
+    long n = 0;
+    for (bqr_hdr *h; n < PLN_BATCH && c->next != c->end; n++, c->next++)
+    {
+        bq *q = s->out[c->next % s->nout];
+        if (!(h = bqr_reserve(q, sizeof(pln_msg)))) break;
+        h->type = 0;
+        *(pln_msg *)(h + 1) = (pln_msg){.seq = c->next, .val = c->next};
+        bqr_commit(q, h);
+    }
+    return n;
+}
+
+static long pln_transform(pln_stage *s)
+{
+    size_t off = 0;
+    long n = 0;
+    for (bqr_hdr *h, *o; n < PLN_BATCH && (h = bqr_peek(s->in[0], &off)); n++, off += BQR_SIZE(h->len))
+    {
+        if (!(o = bqr_reserve(s->out[0], sizeof(pln_msg)))) break;
+        pln_msg *m = (pln_msg *)(o + 1);
+        o->type = 0;
+        *m = *(pln_msg *)(h + 1);
+        m->val *= 3;
+        bqr_commit(s->out[0], o);
+    }
+    if (off) bq_pop(s->in[0], off);
+    return n;
+}
+
+// Checks the order of the messages of each input, sent in turn
+static long pln_sink(pln_stage *s)
+{
+    pln_counter *c = s->ctx;
+    long n = 0;
+    for (unsigned i = 0; i < s->nin; i++)
+    {
+        size_t off = 0;
+        for (bqr_hdr *h; (h = bqr_peek(s->in[i], &off)); n++, off += BQR_SIZE(h->len))
+        {
+            pln_msg *m = (pln_msg *)(h + 1);
+            assert(m->seq % s->nin == i && m->val == m->seq * c[i].mult);
+            assert(m->seq == c[i].next);
+            c[i].next += s->nin;
+        }
+        if (off) bq_pop(s->in[i], off);
+    }
+    return n;
+}
+
+static void pln_run(void)
+{
+    topo t;
+    int err = topo_read(&t, NULL);
+    assert(!err && t.n >= 1);
+    unsigned usable = 0;
+    for (unsigned c = 0; c < t.n; c++)
+        usable += t.cpu[c].usable;
+    printf("Topology: %u usable CPUs, L2 %zu KB, L3 %zu KB\n", usable, t.l2_size >> 10, t.l3_size >> 10);
+    (void)err;
+
+    if (BQ_THREADING == BQ_SINGLE) return;
+
+    printf("Running pipeline test on %llu messages\n", PLN_RECORDS);
+
+    // A source fanning out to two transforms, fanning in to a sink
+    pln p;
+    pln_init(&p);
+    pln_counter src = {.end = PLN_RECORDS}, sink[2] = {{.next = 0, .mult = 3}, {.next = 1, .mult = 3}};
+    int a = pln_add(&p, "source", pln_source, &src);
+    int b = pln_add(&p, "transform 0", pln_transform, NULL);
+    int c = pln_add(&p, "transform 1", pln_transform, NULL);
+    int d = pln_add(&p, "sink", pln_sink, sink);
+    pln_connect(&p, a, b, 0);
+    pln_connect(&p, a, c, 0);
+    pln_connect(&p, b, d, 0);
+    pln_connect(&p, c, d, 64 * 1024);
+    // A preset CPU outside of the topology is rejected
+    p.stage[d].cpu = t.n;
+    assert(pln_start(&p, &t) == -1 && !p.edge[0].q.data);
+    p.stage[d].cpu = -1;
+    err = pln_start(&p, &t);
+    assert(!err);
+    pln_wait(&p, 1000);
+    assert(sink[0].next == PLN_RECORDS && sink[1].next == PLN_RECORDS + 1);
+    assert(p.edge[3].size == 64 * 1024 && p.stage[d].cpu >= 0);
+    pln_report(&p, stdout);
+    pln_free(&p);
+
+    // A source that never ends, stopped: what it sent is drained
+    pln_init(&p);
+    src = (pln_counter){.end = ~0ull};
+    sink[0] = (pln_counter){.mult = 1};
+    a = pln_add(&p, "endless", pln_source, &src);
+    d = pln_add(&p, "sink", pln_sink, sink);
+    pln_connect(&p, a, d, 0);
+    err = pln_start(&p, NULL);
+    assert(!err);
+    usleep(PLN_STOP_USEC);
+    pln_stop(&p);
+    pln_wait(&p, 1000);
+    assert(src.next > 0 && sink[0].next == src.next && p.stage[a].cpu == -1);
+    pln_free(&p);
+}
+
+// Writes [value] to the file [path] of the CPU [cpu] under [root],
+// creating the directories
+static void topo_fake_file(const char *root, int cpu, const char *path, const char *value)
+{
+    char name[256];
+    if (cpu < 0) snprintf(name, sizeof(name), "%s/%s", root, path);
+    else snprintf(name, sizeof(name), "%s/cpu%d/%s", root, cpu, path);
+    for (char *p = name + strlen(root) + 1; (p = strchr(p, '/')); p++)
+    {
+        *p = 0;
+        mkdir(name, 0700);
+        *p = '/';
+    }
+    FILE *f = fopen(name, "w");
+    assert(f);
+    fprintf(f, "%s\n", value);
+    fclose(f);
+}
+
+static void topo_run(void)
+{
+    printf("Running topology test on a fake machine of %d CPUs\n", TOPO_FAKE_CPUS);
+
+    // Two packages with an L3 each, L2 shared by two cores, two threads
+    // per core: CPUs 2k and 2k + 1 are siblings
+    char root[] = "/tmp/topo_XXXXXX";
+    assert(mkdtemp(root));
+    char list[32];
+    snprintf(list, sizeof(list), "0-%d", TOPO_FAKE_CPUS - 1);
+    topo_fake_file(root, -1, "online", list);
+    for (int c = 0; c < TOPO_FAKE_CPUS; c++)
+    {
+        snprintf(list, sizeof(list), "%d", c / 8);
+        topo_fake_file(root, c, "topology/physical_package_id", list);
+        snprintf(list, sizeof(list), "%d", c / 2 % 4);
+        topo_fake_file(root, c, "topology/core_id", list);
+        snprintf(list, sizeof(list), "%d-%d", c & ~1, c | 1);
+        topo_fake_file(root, c, "topology/thread_siblings_list", list);
+        topo_fake_file(root, c, "cache/index0/level", "1");
+        topo_fake_file(root, c, "cache/index0/type", "Data");
+        topo_fake_file(root, c, "cache/index0/shared_cpu_list", list);
+        topo_fake_file(root, c, "cache/index1/level", "2");
+        topo_fake_file(root, c, "cache/index1/type", "Unified");
+        topo_fake_file(root, c, "cache/index1/size", "2048K");
+        snprintf(list, sizeof(list), "%d-%d", c & ~3, c | 3);
+        topo_fake_file(root, c, "cache/index1/shared_cpu_list", list);
+        topo_fake_file(root, c, "cache/index2/level", "3");
+        topo_fake_file(root, c, "cache/index2/type", "Unified");
+        topo_fake_file(root, c, "cache/index2/size", "32M");
+        snprintf(list, sizeof(list), "%d-%d", c & ~7, c | 7);
+        topo_fake_file(root, c, "cache/index2/shared_cpu_list", list);
+    }
+
+    topo t;
+    int err = topo_read(&t, root);
+    assert(!err && t.n == TOPO_FAKE_CPUS && t.l2_size == 2 << 20 && t.l3_size == 32 << 20);
+    assert(topo_distance(&t, 0, 1) == TOPO_SMT && topo_distance(&t, 0, 2) == TOPO_L2);
+    assert(topo_distance(&t, 0, 4) == TOPO_L3 && topo_distance(&t, 0, 8) == TOPO_FAR);
+
+    // Pairs on two cores sharing an L2, or on siblings, spread on the L3s
+    for (int smt = 0; smt < 2; smt++)
+    {
+        int cpus[2 * TOPO_PAIRS];
+        unsigned l3[2] = {0};
+        unsigned char seen[TOPO_FAKE_CPUS] = {0};
+        err = topo_pair(&t, TOPO_PAIRS, smt, cpus);
+        assert(!err);
+        for (int i = 0; i < TOPO_PAIRS; i++)
+        {
+            int a = cpus[2 * i], b = cpus[2 * i + 1];
+            assert(topo_distance(&t, a, b) == (smt ? TOPO_SMT : TOPO_L2));
+            assert(!seen[a]++ && !seen[b]++);
+            l3[a / 8]++;
+        }
+        assert(l3[0] == TOPO_PAIRS / 2 && l3[1] == TOPO_PAIRS / 2);
+    }
+
+    // More pairs than CPUs: they are reused
+    int many[4 * TOPO_FAKE_CPUS];
+    err = topo_pair(&t, 2 * TOPO_FAKE_CPUS, 0, many);
+    assert(!err);
+    for (int i = 0; i < 2 * TOPO_FAKE_CPUS; i++)
+        assert(many[2 * i] != many[2 * i + 1] && topo_distance(&t, many[2 * i], many[2 * i + 1]) == TOPO_L2);
+
+    snprintf(list, sizeof(list), "rm -r %s", root);
+    err = system(list);
+    assert(!err);
+
+    // This machine: pin this thread, then put its mask back
+    err = topo_read(&t, NULL);
+    assert(!err);
+    int cpus[2];
+    err = topo_pair(&t, 1, 0, cpus);
+    assert(!err && t.cpu[cpus[0]].usable && t.cpu[cpus[1]].usable);
+    cpu_set_t mask;
+    pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask);
+    err = topo_pin(pthread_self(), cpus[1]);
+    assert(!err && sched_getcpu() == cpus[1]);
+    pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+    (void)err;
+}
+
 static void *producer_thread(void *arg)
 {
     (void)arg;
@@ -100,10 +2269,11 @@ static void *producer_thread(void *arg)
     size_t vbq_remaining = BYTES_TO_PRODUCE;
     size_t abq_remaining = BYTES_TO_PRODUCE;
     size_t lfq_remaining = BYTES_TO_PRODUCE;
-    size_t bq_remaining = BYTES_TO_PRODUCE;
+    size_t bq_remaining = BQ_THREADED_BYTES;
+    size_t cbq_remaining = BYTES_TO_PRODUCE;
 
     while (bbq_remaining > 0 || vbq_remaining > 0 || abq_remaining > 0 ||
-        lfq_remaining > 0 || bq_remaining > 0)
+        lfq_remaining > 0 || bq_remaining > 0 || cbq_remaining > 0)
     {
         usleep(rand() % MAX_SLEEP_USEC);
         
@@ -191,6 +2361,27 @@ static void *producer_thread(void *arg)
 
             free(bytes);
         }
+
+        if (cbq_remaining > 0)
+        {
+            size_t count = MIN(MAX_BYTES_PER_OP, cbq_remaining);
+            uint8_t *bytes = malloc(count);
+            assert(bytes);
+            for (size_t i = 0; i < count; i++)
+                bytes[i] = cbq_remaining - i;
+
+            TIME("CBQ push")
+            {
+                size_t pushable;
+                uint8_t *addr = cbq_pushbuf(cbq_queue, &pushable);
+                count = MIN(count, pushable);
+                memcpy(addr, bytes, count);
+                cbq_push(cbq_queue, count);
+            }
+            cbq_remaining -= count;
+
+            free(bytes);
+        }
     }
 
     __atomic_store_n(&prod_finished, true, __ATOMIC_RELEASE);
@@ -206,10 +2397,11 @@ static void *consumer_thread(void *arg)
     size_t vbq_remaining = BYTES_TO_PRODUCE;
     size_t abq_remaining = BYTES_TO_PRODUCE;
     size_t lfq_remaining = BYTES_TO_PRODUCE;
-    size_t bq_remaining = BYTES_TO_PRODUCE;
+    size_t bq_remaining = BQ_THREADED_BYTES;
+    size_t cbq_remaining = BYTES_TO_PRODUCE;
 
     while (bbq_remaining > 0 || vbq_remaining > 0 || abq_remaining > 0 ||
-        lfq_remaining > 0 || bq_remaining > 0 || !prod_finished)
+        lfq_remaining > 0 || bq_remaining > 0 || cbq_remaining > 0 || !prod_finished)
     {
         usleep(rand() % MAX_SLEEP_USEC);
 
@@ -292,6 +2484,23 @@ static void *consumer_thread(void *arg)
             TIME("BQ commit pop")
                 bq_pop(&bq_queue, count);
         }
+
+        if (cbq_remaining > 0)
+        {
+            size_t count;
+            uint8_t *addr;
+            TIME("CBQ get pop buf")
+                addr = cbq_popbuf(cbq_queue, &count);
+
+            count = MIN(count, cbq_remaining);
+            count = MIN(count, MAX_BYTES_PER_OP);
+
+            for (size_t i = 0; i < count; i++)
+                assert(addr[i] == (uint8_t)(cbq_remaining--));
+
+            TIME("CBQ commit pop")
+                cbq_pop(cbq_queue, count);
+        }
     }
 
     return NULL;
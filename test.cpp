@@ -0,0 +1,516 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <istream>
+#include <memory_resource>
+#include <ostream>
+#include <sstream>
+#include <thread>
+
+#include "bq.hpp"
+#include "bqco.hpp"
+#include "bqs.hpp"
+#include "rba.hpp"
+#include "profiler.h"
+
+#define BYTES_TO_PRODUCE    256*1024*1024ull
+#define QUEUE_SIZE          1024*1024ull
+#define MAX_BYTES_PER_OP    1024ull
+#define SINGLE_THREAD_OPS   (1024*1024ull)
+#define SINGLE_THREAD_BYTES 16ull
+#define PING_PONG_ROUNDS    (256*1024ull)
+#define PING_PONG_RING      4096ull
+#define ASYNC_BYTES         64*1024*1024ull
+#define STREAM_BATCHES      1024ull
+#define STREAM_VALUES       1024ull
+#define PMR_OPS             (256*1024ull)
+#define PMR_WINDOW          64
+
+static void single_thread_run(void)
+{
+    printf("Running single thread test on %llu push/pop of %llu B, C and C++ API\n",
+        SINGLE_THREAD_OPS, SINGLE_THREAD_BYTES);
+    bqpp::ring<> r(QUEUE_SIZE);
+    unsigned char val = 0, expected = 0;
+
+    TIME("BQ C API single thread push/pop")
+    {
+        bq *q = r.native();
+        for (size_t i = 0; i < SINGLE_THREAD_OPS; i++)
+        {
+            size_t count;
+            unsigned char *addr = (unsigned char *)bq_pushbuf(q, &count);
+            count = count < SINGLE_THREAD_BYTES ? count : SINGLE_THREAD_BYTES;
+            for (size_t j = 0; j < count; j++)
+                addr[j] = val++;
+            bq_push(q, count);
+
+            addr = (unsigned char *)bq_popbuf(q, &count);
+            for (size_t j = 0; j < count; j++)
+                assert(addr[j] == expected++);
+            bq_pop(q, count);
+        }
+    }
+
+    TIME("BQ C++ guards single thread push/pop")
+    {
+        for (size_t i = 0; i < SINGLE_THREAD_OPS; i++)
+        {
+            {
+                auto w = r.write();
+                auto buf = w.bytes().first.first(std::min<size_t>(w.bytes().first.size(), SINGLE_THREAD_BYTES));
+                for (std::byte &b : buf)
+                    b = std::byte(val++);
+                w.commit(buf.size());
+            }
+
+            auto rd = r.read();
+            for (std::byte b : rd.bytes().first)
+                assert(b == std::byte(expected++));
+            rd.commit(rd.bytes().first.size());
+        }
+    }
+
+    assert(expected == val);
+}
+
+static void segments_run(void)
+{
+    puts("Running C++ ring segments and ownership test");
+
+    // Allocator aware: the buffer comes from the monotonic resource
+    alignas(64) static std::byte arena[4 * 4096];
+    std::pmr::monotonic_buffer_resource res(arena, sizeof(arena));
+    bqpp::ring<std::pmr::polymorphic_allocator<std::byte>> a(4096 + 100, &res);
+    assert(a.capacity() == 4096);
+    assert(a.writable().data() >= arena && a.writable().data() < arena + sizeof(arena));
+
+    // Move the tail 16 bytes before the end of the buffer
+    a.push(4096 - 16);
+    a.pop(4096 - 16);
+
+    auto w = a.writable_segments();
+    assert(w.first.size() == 16 && w.second.size() == 4096 - 16);
+    assert(a.writable().size() == 16);
+    for (size_t i = 0; i < 64; i++)
+        w[i] = std::byte(i);
+    a.push(64);
+
+    // Moving keeps the state, the moved from ring is empty
+    auto b = std::move(a);
+    assert(a.capacity() == 0);
+    assert(b.capacity() == 4096);
+    assert(a.writable().empty() && a.readable().empty());
+    assert(a.writable_segments().size() == 0 && a.readable_segments().size() == 0);
+    {
+        auto g = a.write();
+        assert(g.bytes().empty());
+    }
+    bqpp::ring<> empty(0);
+    assert(empty.writable().empty() && empty.readable().empty());
+
+    auto r = b.readable_segments();
+    assert(r.size() == 64 && r.first.size() == 16 && r.second.size() == 48);
+    assert(b.readable().size() == 16);
+    assert(r.end() - r.begin() == 64);
+    for (size_t i = 0; i < 64; i++)
+        assert(r.begin()[i] == std::byte(i));
+
+    // The segment halves have contiguous iterators
+    static_assert(std::contiguous_iterator<decltype(r.first.begin())>);
+    static_assert(std::random_access_iterator<bqpp::segments::iterator>);
+
+    // Nothing is popped until the guard goes out of scope
+    {
+        auto g = b.read();
+        g.commit(10);
+        g.commit(10);
+        assert(b.readable_segments().size() == 64);
+    }
+    assert(b.readable_segments().size() == 44);
+}
+
+static void threaded_run(void)
+{
+    printf("Running C++ ring test on moving %llu MB, queue of %llu MB, max %llu B per operation\n",
+        BYTES_TO_PRODUCE >> 20, QUEUE_SIZE >> 20, MAX_BYTES_PER_OP);
+    bqpp::ring<> r(QUEUE_SIZE);
+
+    std::thread prod([&r] {
+        unsigned char val = 0;
+        for (size_t produced = 0; produced < BYTES_TO_PRODUCE;)
+        {
+            auto w = r.write();
+            if (w.bytes().empty()) { std::this_thread::yield(); continue; }
+
+            size_t count = std::min<size_t>(w.bytes().size(), rand() % MAX_BYTES_PER_OP + 1);
+            count = std::min<size_t>(count, BYTES_TO_PRODUCE - produced);
+            TIME("BQ C++ write guard")
+            {
+                auto it = w.bytes().begin();
+                for (size_t i = 0; i < count; i++)
+                    *it++ = std::byte(val++);
+                w.commit(count);
+            }
+            produced += count;
+        }
+    });
+
+    unsigned char expected = 0;
+    for (size_t consumed = 0; consumed < BYTES_TO_PRODUCE;)
+    {
+        auto rd = r.read();
+        if (rd.bytes().empty()) { std::this_thread::yield(); continue; }
+
+        size_t count = std::min<size_t>(rd.bytes().size(), MAX_BYTES_PER_OP);
+        TIME("BQ C++ read guard")
+        {
+            for (std::byte b : rd.bytes().first.first(std::min(count, rd.bytes().first.size())))
+                assert(b == std::byte(expected++));
+            if (count > rd.bytes().first.size())
+                for (std::byte b : rd.bytes().second.first(count - rd.bytes().first.size()))
+                    assert(b == std::byte(expected++));
+            rd.commit(count);
+        }
+        consumed += count;
+    }
+
+    prod.join();
+}
+
+// A coroutine started right away and destroyed by its owner
+struct task
+{
+    struct promise_type
+    {
+        task get_return_object() { return {std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { abort(); }
+    };
+    std::coroutine_handle<promise_type> h;
+};
+
+static task ping(bqpp::async_ring<> &out, bqpp::async_ring<> &in, uint64_t rounds)
+{
+    for (uint64_t i = 0; i < rounds; i++)
+    {
+        bqpp::segments w = co_await out.writable(sizeof(i));
+        memcpy(w.first.data(), &i, sizeof(i));
+        out.push(sizeof(i));
+
+        uint64_t v;
+        bqpp::segments r = co_await in.readable(sizeof(v));
+        memcpy(&v, r.first.data(), sizeof(v));
+        assert(v == i);
+        in.pop(sizeof(v));
+    }
+}
+
+static task pong(bqpp::async_ring<> &in, bqpp::async_ring<> &out)
+{
+    for (;;)
+    {
+        uint64_t v;
+        bqpp::segments r = co_await in.readable(sizeof(v));
+        memcpy(&v, r.first.data(), sizeof(v));
+        in.pop(sizeof(v));
+
+        bqpp::segments w = co_await out.writable(sizeof(v));
+        memcpy(w.first.data(), &v, sizeof(v));
+        out.push(sizeof(v));
+    }
+}
+
+static void ping_pong_run(void)
+{
+    printf("Running ping-pong test on %llu round trips of 8 B, coroutines and threads\n", PING_PONG_ROUNDS);
+
+    {
+        bqpp::async_ring<> a(PING_PONG_RING), b(PING_PONG_RING);
+        task t2 = pong(a, b);
+        TIME("BQ coroutine ping-pong")
+        {
+            task t1 = ping(a, b, PING_PONG_ROUNDS);
+            assert(t1.h.done());
+            t1.h.destroy();
+        }
+        t2.h.destroy();
+    }
+
+    if (BQ_THREADING == BQ_SINGLE) return;
+    bqpp::ring<> a(PING_PONG_RING), b(PING_PONG_RING);
+    std::thread t([&a, &b] {
+        for (uint64_t i = 0; i < PING_PONG_ROUNDS; i++)
+        {
+            uint64_t v;
+            while (a.readable().size() < sizeof(v)) std::this_thread::yield();
+            memcpy(&v, a.readable().data(), sizeof(v));
+            a.pop(sizeof(v));
+            while (b.writable().size() < sizeof(v)) std::this_thread::yield();
+            memcpy(b.writable().data(), &v, sizeof(v));
+            b.push(sizeof(v));
+        }
+    });
+
+    TIME("BQ thread ping-pong")
+    {
+        for (uint64_t i = 0; i < PING_PONG_ROUNDS; i++)
+        {
+            while (a.writable().size() < sizeof(i)) std::this_thread::yield();
+            memcpy(a.writable().data(), &i, sizeof(i));
+            a.push(sizeof(i));
+
+            uint64_t v;
+            while (b.readable().size() < sizeof(v)) std::this_thread::yield();
+            memcpy(&v, b.readable().data(), sizeof(v));
+            assert(v == i);
+            b.pop(sizeof(v));
+        }
+    }
+    t.join();
+}
+
+// Executor handing the woken coroutine to the event loop of its thread,
+// through a bq of handles: the producer thread is the only one waking
+static void post_handle(void *ctx, std::coroutine_handle<> h)
+{
+    bqpp::ring<> *run = static_cast<bqpp::ring<> *>(ctx);
+    void *addr = h.address();
+    auto w = run->writable();
+    assert(w.size() >= sizeof(addr));
+    memcpy(w.data(), &addr, sizeof(addr));
+    run->push(sizeof(addr));
+}
+
+static task async_consumer(bqpp::async_ring<> &r, size_t total)
+{
+    unsigned char expected = 0;
+    for (size_t consumed = 0; consumed < total;)
+    {
+        auto rd = r.read();
+        if (rd.bytes().empty())
+        {
+            co_await r.readable(1);
+            continue;
+        }
+        for (std::byte b : rd.bytes())
+            assert(b == std::byte(expected++));
+        rd.commit(rd.bytes().size());
+        consumed += rd.bytes().size();
+    }
+}
+
+static void async_run(void)
+{
+    printf("Running coroutine consumer test on moving %llu MB, queue of %llu MB\n", ASYNC_BYTES >> 20, QUEUE_SIZE >> 20);
+    bqpp::async_ring<> r(QUEUE_SIZE);
+    bqpp::ring<> run(64);
+    r.set_executor(post_handle, &run);
+
+    std::thread prod([&r] {
+        unsigned char val = 0;
+        for (size_t produced = 0; produced < ASYNC_BYTES;)
+        {
+            auto w = r.write();
+            if (w.bytes().empty()) { std::this_thread::yield(); continue; }
+
+            size_t count = std::min<size_t>(w.bytes().size(), rand() % MAX_BYTES_PER_OP + 1);
+            count = std::min<size_t>(count, ASYNC_BYTES - produced);
+            auto it = w.bytes().begin();
+            for (size_t i = 0; i < count; i++)
+                *it++ = std::byte(val++);
+            w.commit(count);
+            produced += count;
+        }
+    });
+
+    // Event loop of the consumer thread
+    task t = async_consumer(r, ASYNC_BYTES);
+    while (!t.h.done())
+    {
+        auto rd = run.readable();
+        if (rd.empty()) { std::this_thread::yield(); continue; }
+
+        void *addr;
+        memcpy(&addr, rd.data(), sizeof(addr));
+        run.pop(sizeof(addr));
+        std::coroutine_handle<>::from_address(addr).resume();
+    }
+    t.h.destroy();
+
+    prod.join();
+}
+
+static void stream_run(void)
+{
+    printf("Running streambuf test on %llu batches of %llu formatted values\n", STREAM_BATCHES, STREAM_VALUES);
+    bqpp::ring<> r(QUEUE_SIZE);
+    bqpp::ringbuf<> out_buf(r), in_buf(r);
+    std::ostream out(&out_buf);
+    std::istream in(&in_buf);
+
+    uint64_t val = 0, expected = 0;
+    std::ostringstream ss;
+    for (size_t i = 0; i < STREAM_BATCHES; i++)
+    {
+        uint64_t batch_start = val;
+
+        // Formatting in a stringstream and copying in the ring...
+        TIME("BQ stringstream and copy")
+        {
+            ss.str("");
+            for (size_t j = 0; j < STREAM_VALUES; j++)
+                ss << val++ << ' ';
+            std::string str = ss.str();
+            bqpp::segments w = r.writable_segments();
+            assert(w.size() >= str.size());
+            size_t first = std::min(str.size(), w.first.size());
+            memcpy(w.first.data(), str.data(), first);
+            memcpy(w.second.data(), str.data() + first, str.size() - first);
+        }
+
+        // ...against formatting straight in the ring
+        val = batch_start;
+        TIME("BQ ostream on ringbuf")
+        {
+            for (size_t j = 0; j < STREAM_VALUES; j++)
+                out << val++ << ' ';
+            out.flush();
+        }
+
+        uint64_t v;
+        TIME("BQ istream on ringbuf")
+        {
+            for (size_t j = 0; j < STREAM_VALUES; j++)
+            {
+                in >> v;
+                assert(v == expected++);
+            }
+        }
+    }
+    assert(in.good() && out.good());
+
+    // An empty ring is end of input, until the producer writes again
+    in >> std::ws;
+    uint64_t v;
+    in >> v;
+    assert(in.eof());
+    in.clear();
+    out << 42 << ' ' << std::flush;
+    in >> v;
+    assert(in.good() && v == 42);
+
+    // Across threads, with a small ring filling up: the writer waits
+    if (BQ_THREADING == BQ_SINGLE) return;
+    bqpp::ring<> small(256);
+    std::thread prod([&small] {
+        bqpp::ringbuf<> b(small);
+        std::ostream o(&b);
+        for (uint64_t i = 0; i < STREAM_VALUES * 16; i++)
+            o << i << '\n' << std::flush;
+    });
+
+    // A value can arrive in two parts: parse up to the end of the line
+    bqpp::ringbuf<> b(small);
+    std::istream i(&b);
+    v = 0;
+    for (uint64_t n = 0; n < STREAM_VALUES * 16;)
+    {
+        int c = i.get();
+        if (c == EOF) { i.clear(); std::this_thread::yield(); }
+        else if (c == '\n') { assert(v == n++); v = 0; }
+        else v = v * 10 + (c - '0');
+    }
+    prod.join();
+}
+
+// Builds and destroys PMR_OPS strings on [res], PMR_WINDOW alive at a time,
+// in FIFO order
+static void pmr_pattern(std::pmr::memory_resource *res)
+{
+    std::pmr::string *live[PMR_WINDOW] = {};
+    for (size_t i = 0; i < PMR_OPS; i++)
+    {
+        std::pmr::string *&s = live[i % PMR_WINDOW];
+        if (s)
+        {
+            assert(s->size() == 32 + (i - PMR_WINDOW) % 256);
+            delete s;
+        }
+        s = new std::pmr::string(32 + i % 256, char('a' + i % 26), res);
+    }
+    for (auto *s : live)
+        delete s;
+}
+
+static void pmr_run(void)
+{
+    printf("Running ring memory resource test on %llu strings, %d alive\n", PMR_OPS, PMR_WINDOW);
+
+    bqpp::ring_resource res(QUEUE_SIZE);
+    TIME("BQ ring_resource strings")
+        pmr_pattern(&res);
+    TIME("new_delete_resource strings")
+        pmr_pattern(std::pmr::new_delete_resource());
+    assert(!res.fallbacks());
+
+    // What does not fit goes upstream
+    std::pmr::vector<char> big(QUEUE_SIZE, 0, &res);
+    assert(res.fallbacks() == 1);
+    std::pmr::vector<char> small(64, 0, &res);
+    assert(res.fallbacks() == 1);
+}
+
+int main()
+{
+    srand(time(NULL));
+
+    single_thread_run();
+    segments_run();
+    ping_pong_run();
+    stream_run();
+    pmr_run();
+    // With BQ_SINGLE a ring can not be shared between threads
+    if (BQ_THREADING != BQ_SINGLE)
+    {
+        threaded_run();
+        async_run();
+    }
+
+    puts("Test ended without errors");
+
+    prf_output_measures(stdout);
+
+    return 0;
+}
+
+PROFILER_GLOBAL_END
@@ -0,0 +1,279 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TOPO_H
+#define TOPO_H
+
+/* The CPU topology of the machine, read from Linux sysfs, to place the
+ * two threads of a bq close to each other. Some notable facts:
+ * 1: Each CPU gets the ids of the domains it belongs to: its package, its
+ *      core, and the L2 and the L3 it shares with other CPUs. The id of
+ *      a shared domain is the first CPU in its sysfs list, -1 when sysfs
+ *      does not tell.
+ * 2: topo_distance ranks how close two CPUs are, from the same CPU to
+ *      different packages. A producer and a consumer on the same L2 or
+ *      L3 move the ring through that cache, further away through the
+ *      interconnect.
+ * 3: Only the CPUs online and in the affinity mask of the process are
+ *      usable. The root of the tree can be changed, to read a copy of
+ *      the sysfs of another machine, in which case the affinity mask is
+ *      not applied.
+ * 4: The cache sizes are the ones of the first usable CPU.
+ * 5: topo_pair places the two threads of each of a set of bq: the two
+ *      CPUs of a pair share an L2, or an L3, on two different cores, or
+ *      on the two threads of one core if SMT is asked for, as siblings
+ *      share more but compete for the core. The pairs go to the L3
+ *      domains with the fewest pairs, so they do not fight for one
+ *      cache. When CPUs run out, they are reused from the start.
+ * 6: topo_pin applies a CPU to a thread with pthread_setaffinity_np.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#define TOPO_MAX_CPUS   256
+#define TOPO_ROOT       "/sys/devices/system/cpu"
+
+enum
+{
+    TOPO_SAME,
+    TOPO_SMT,
+    TOPO_L2,
+    TOPO_L3,
+    TOPO_PACKAGE,
+    TOPO_FAR,
+};
+
+typedef struct
+{
+    int usable;
+    int package, core, smt, l2, l3;
+} topo_cpu;
+
+typedef struct
+{
+    unsigned n;
+    size_t l2_size, l3_size;
+    topo_cpu cpu[TOPO_MAX_CPUS];
+} topo;
+
+// Reads the first line of the file [path] of [cpu], or of [root] if [cpu]
+// is -1. Returns 0 on success, -1 otherwise.
+static int topo_file_(const char *root, int cpu, const char *path, char *buf, size_t len)
+{
+    char name[256];
+    if (cpu < 0) snprintf(name, sizeof(name), "%s/%s", root, path);
+    else snprintf(name, sizeof(name), "%s/cpu%d/%s", root, cpu, path);
+    FILE *f = fopen(name, "r");
+    if (!f) return -1;
+    char *line = fgets(buf, len, f);
+    fclose(f);
+    return line ? 0 : -1;
+}
+
+static int topo_int_(const char *root, int cpu, const char *path, int def)
+{
+    char buf[64];
+    return topo_file_(root, cpu, path, buf, sizeof(buf)) ? def : atoi(buf);
+}
+
+// Marks in [set] the CPUs of the list [s], like "0-3,8,10-11"
+static void topo_list_(const char *s, unsigned char *set)
+{
+    while (*s >= '0' && *s <= '9')
+    {
+        char *end;
+        long a = strtol(s, &end, 10), b = a;
+        if (*end == '-') b = strtol(end + 1, &end, 10);
+        for (long i = a; i <= b && i < TOPO_MAX_CPUS; i++)
+            set[i] = 1;
+        s = *end == ',' ? end + 1 : end;
+    }
+}
+
+static size_t topo_size_(const char *s)
+{
+    char *end;
+    size_t size = strtoul(s, &end, 10);
+    return *end == 'K' ? size << 10 : *end == 'M' ? size << 20 : size;
+}
+
+/* Reads in [t] the topology under [root], NULL for the one of this
+ * machine. Returns 0 on success, -1 if no CPU is usable. */
+static int topo_read(topo *t, const char *root)
+{
+    char buf[1024];
+    unsigned char online[TOPO_MAX_CPUS] = {0};
+    memset(t, 0, sizeof(*t));
+    if (topo_file_(root ? root : TOPO_ROOT, -1, "online", buf, sizeof(buf))) return -1;
+    topo_list_(buf, online);
+
+    cpu_set_t mask;
+    int masked = !root && !sched_getaffinity(0, sizeof(mask), &mask);
+    root = root ? root : TOPO_ROOT;
+
+    for (int c = 0; c < TOPO_MAX_CPUS; c++)
+    {
+        if (!online[c]) continue;
+        topo_cpu *cpu = t->cpu + c;
+        t->n = c + 1;
+        cpu->usable = !masked || CPU_ISSET(c, &mask);
+        cpu->package = topo_int_(root, c, "topology/physical_package_id", 0);
+        cpu->core = topo_int_(root, c, "topology/core_id", c);
+        cpu->smt = topo_int_(root, c, "topology/thread_siblings_list", c);
+        cpu->l2 = cpu->l3 = -1;
+        int sizes = cpu->usable && !t->l2_size && !t->l3_size;
+
+        for (int i = 0;; i++)
+        {
+            char path[64];
+            snprintf(path, sizeof(path), "cache/index%d/level", i);
+            int level = topo_int_(root, c, path, -1);
+            if (level < 0) break;
+            snprintf(path, sizeof(path), "cache/index%d/type", i);
+            if (topo_file_(root, c, path, buf, sizeof(buf)) || !strncmp(buf, "Instruction", 11))
+                continue;
+            if (level != 2 && level != 3) continue;
+
+            snprintf(path, sizeof(path), "cache/index%d/shared_cpu_list", i);
+            int id = topo_int_(root, c, path, c);
+            snprintf(path, sizeof(path), "cache/index%d/size", i);
+            size_t size = topo_file_(root, c, path, buf, sizeof(buf)) ? 0 : topo_size_(buf);
+            if (level == 2)
+            {
+                cpu->l2 = id;
+                if (sizes) t->l2_size = size;
+            }
+            else
+            {
+                cpu->l3 = id;
+                if (sizes) t->l3_size = size;
+            }
+        }
+    }
+
+    for (unsigned c = 0; c < t->n; c++)
+        if (t->cpu[c].usable) return 0;
+    return -1;
+}
+
+/* How close the CPUs [a] and [b] of [t] are, from TOPO_SAME to TOPO_FAR */
+static int topo_distance(const topo *t, int a, int b)
+{
+    const topo_cpu *x = t->cpu + a, *y = t->cpu + b;
+    if (a == b) return TOPO_SAME;
+    if (x->package != y->package) return TOPO_FAR;
+    if (x->smt == y->smt) return TOPO_SMT;
+    if (x->l2 >= 0 && x->l2 == y->l2) return TOPO_L2;
+    if (x->l3 >= 0 && x->l3 == y->l3) return TOPO_L3;
+    return TOPO_PACKAGE;
+}
+
+/* The size of the smallest cache shared by the CPUs [a] and [b] of [t],
+ * 0 if they share none */
+static size_t topo_shared_cache(const topo *t, int a, int b)
+{
+    int d = topo_distance(t, a, b);
+    return d <= TOPO_L2 ? t->l2_size : d == TOPO_L3 ? t->l3_size : 0;
+}
+
+// The L3 domain of [c], or its package when sysfs does not tell, as the
+// first CPU in it
+static int topo_domain_(const topo *t, int c)
+{
+    if (t->cpu[c].l3 >= 0) return t->cpu[c].l3;
+    for (unsigned i = 0;; i++)
+        if (t->cpu[i].package == t->cpu[c].package) return i;
+}
+
+/* Assigns CPUs of [t] to [n] producer consumer pairs, the pair [i] to
+ * [cpus[2 * i]] and [cpus[2 * i + 1]], on SMT siblings if [smt].
+ * Returns 0 on success, -1 if no CPU is usable. */
+static int topo_pair(const topo *t, unsigned n, int smt, int *cpus)
+{
+    // How good a pair is, by distance
+    static const unsigned rank[2][TOPO_FAR + 1] = {
+        [0] = {[TOPO_L2] = 0, [TOPO_L3] = 1, [TOPO_SMT] = 2, [TOPO_PACKAGE] = 3, [TOPO_FAR] = 4, [TOPO_SAME] = 5},
+        [1] = {[TOPO_SMT] = 0, [TOPO_L2] = 1, [TOPO_L3] = 2, [TOPO_PACKAGE] = 3, [TOPO_FAR] = 4, [TOPO_SAME] = 5},
+    };
+    unsigned char used[TOPO_MAX_CPUS] = {0};
+    unsigned pairs[TOPO_MAX_CPUS] = {0}, usable = 0;
+    for (unsigned c = 0; c < t->n; c++)
+        usable += t->cpu[c].usable;
+    if (!usable) return -1;
+
+    for (unsigned i = 0, left = usable; i < n; i++)
+    {
+        if (left < 2)
+        {
+            memset(used, 0, sizeof(used));
+            left = usable;
+        }
+
+        // The closest pair in the least loaded domain. The same CPU twice
+        // only when it is the last one.
+        unsigned best = ~0u;
+        for (unsigned a = 0; a < t->n; a++)
+        {
+            if (!t->cpu[a].usable || used[a]) continue;
+            for (unsigned b = left < 2 ? a : 0; b < t->n; b++)
+            {
+                if (!t->cpu[b].usable || used[b] || (a == b && left >= 2)) continue;
+                unsigned key = pairs[topo_domain_(t, a)] * (TOPO_FAR + 2) +
+                    rank[!!smt][topo_distance(t, a, b)];
+                if (key < best)
+                {
+                    best = key;
+                    cpus[2 * i] = a;
+                    cpus[2 * i + 1] = b;
+                }
+            }
+        }
+
+        int a = cpus[2 * i], b = cpus[2 * i + 1];
+        pairs[topo_domain_(t, a)]++;
+        used[a] = used[b] = 1;
+        left -= a == b ? 1 : 2;
+    }
+    return 0;
+}
+
+/* Runs [thread] on [cpu] only. Returns 0 on success, -1 otherwise. */
+static int topo_pin(pthread_t thread, int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) ? -1 : 0;
+}
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TXQ_H
+#define TXQ_H
+
+/* Reservations that can be aborted, and commits of several byte queues
+ * at once. Some notable facts:
+ * 1: A reservation is the region of bq_pushbuf with a name: txq_reserve
+ *      fails unless [len] contiguous bytes are free, txq_abort drops it
+ *      and txq_push commits part of it. As bq_pushbuf changes nothing,
+ *      an aborted reservation leaves no trace and the next one reuses
+ *      the same bytes.
+ * 2: The queues of a group are committed together by txq_commit, with a
+ *      sequence lock: the sequence is odd while the tails are being
+ *      stored, and every commit adds 2. A consumer takes a snapshot of
+ *      all the tails with txq_snapshot, which retries while a commit is
+ *      in progress (spinning, then yielding), and reads each queue up to its snapshot tail with
+ *      txq_popbuf. Consumers with the same snapshot epoch see the same
+ *      commits on all the queues.
+ * 3: The queues of a group MUST be pushed only through txq_commit, by a
+ *      single producer. A consumer reading with bq_popbuf sees the tails
+ *      as they are stored, so commits can look partial to it.
+ * 4: A snapshot only bounds what is read: a consumer pops with bq_pop as
+ *      usual, and the producer free space is unaffected.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sched.h>
+#include <x86intrin.h>
+
+#include "bq.h"
+
+#define TXQ_MAX_QUEUES 8
+#define TXQ_SPINS      64
+
+typedef struct
+{
+    bq *q;
+    char *buf;
+    size_t len;
+} txq_rsv;
+
+typedef struct
+{
+    _Alignas(64) uint64_t seq;
+    _Alignas(64) bq *q[TXQ_MAX_QUEUES];
+    unsigned n;
+} txq_group;
+
+/* Reserves [len] contiguous bytes of [q] in [r]. Returns 0 on success,
+ * with [r->len] set to all the contiguous free bytes, -1 otherwise. */
+static int txq_reserve(txq_rsv *r, bq *q, size_t len)
+{
+    r->q = q;
+    r->buf = bq_pushbuf(q, &r->len);
+    if (r->len >= len) return 0;
+    r->buf = NULL;
+    r->len = 0;
+    return -1;
+}
+
+/* Drops the reservation [r], nothing of it gets pushed */
+static void txq_abort(txq_rsv *r)
+{
+    r->buf = NULL;
+    r->len = 0;
+}
+
+/* Pushes the first [count] bytes of the reservation [r], alone. [r] MUST
+ * not be in a group. */
+static void txq_push(txq_rsv *r, size_t count)
+{
+    bq_push(r->q, count);
+    txq_abort(r);
+}
+
+/* Initializes [g] with the [n] queues [q]. [n] MUST be at most
+ * TXQ_MAX_QUEUES. */
+static void txq_group_init(txq_group *g, bq **q, unsigned n)
+{
+    g->seq = 0;
+    g->n = n;
+    for (unsigned i = 0; i < n; i++)
+        g->q[i] = q[i];
+}
+
+/* Producer side: pushes [count[i]] bytes of the reservation [r[i]] for
+ * each of the [n] reservations, all on queues of [g], as one commit */
+static void txq_commit(txq_group *g, txq_rsv *r, const size_t *count, unsigned n)
+{
+    uint64_t seq = g->seq;
+    __atomic_store_n(&g->seq, seq + 1, __ATOMIC_RELAXED);
+    // The odd sequence is visible before any tail
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (unsigned i = 0; i < n; i++)
+    {
+        bq_push(r[i].q, count[i]);
+        txq_abort(r + i);
+    }
+
+    __atomic_store_n(&g->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Consumer side: stores in [tails] the tails of all the queues of [g]
+ * after the same commit and returns its epoch */
+static uint64_t txq_snapshot(txq_group *g, size_t *tails)
+{
+    for (unsigned spins = 0;; spins++)
+    {
+        uint64_t seq = __atomic_load_n(&g->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            // The producer can be preempted in the middle of a commit
+            if (spins < TXQ_SPINS) _mm_pause();
+            else sched_yield();
+            continue;
+        }
+
+        for (unsigned i = 0; i < g->n; i++)
+            tails[i] = __atomic_load_n(&g->q[i]->tail, __ATOMIC_ACQUIRE);
+
+        // The tails are read before the sequence is read again
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&g->seq, __ATOMIC_RELAXED) == seq) return seq / 2;
+    }
+}
+
+/* Consumer side: same as bq_popbuf on [q], up to the snapshot [tail] */
+static void *txq_popbuf(bq *q, size_t tail, size_t *len)
+{
+    bq_check_(q, consumer);
+    size_t off = q->head & q->mask;
+    size_t avail = tail - q->head;
+    *len = avail < q->mask + 1 - off ? avail : q->mask + 1 - off;
+    return q->data + off;
+}
+
+#endif
@@ -0,0 +1,346 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Raffaele del Gaudio, https://delgaudio.me
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WSQ_H
+#define WSQ_H
+
+/* A work-stealing task pool. Each worker thread owns a deque of tasks
+ * (wsq): the owner pushes and pops at the bottom, other workers steal
+ * at the top. Some notable facts:
+ * 1: The deque is the one of Chase and Lev, on a fixed ring of tasks.
+ *      As in bq.h the ring length is a power of 2 and top and bottom
+ *      are stored without the modulo, so the size is (bottom - top)
+ *      and every index is reduced with a bitwise AND. When the deque
+ *      is full the task is run inline by the spawner.
+ * 2: The owner never needs an atomic instruction, except when popping
+ *      the very last task, which may race with a thief. Thieves race
+ *      between them with a CAS on top.
+ * 3: A thief moves up to half of the victim's tasks to its own deque,
+ *      one CAS per task: a single CAS covering many tasks would race
+ *      with the owner popping the same tasks from the bottom.
+ * 4: Tasks spawned by a thread that is not a worker go to a mutex
+ *      protected injection ring, drained by idle workers.
+ * 5: Fork/join uses a pending counter: wsq_spawn increments it and the
+ *      task decrements it when done. wsq_wait runs other tasks, instead
+ *      of blocking, until the counter drops to 0.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "bq.h"
+
+typedef struct
+{
+    void (*fn)(void *);
+    void *arg;
+    size_t *pending;
+    // Pads the task to 32 bytes so that a power of 2 ring of bytes, like
+    // the injection bq, always holds a whole number of tasks
+    void *reserved;
+} wsq_task;
+
+typedef struct
+{
+    // Written by thieves
+    _Alignas(64) size_t top;
+    // Written only by the owner
+    _Alignas(64) size_t bottom;
+    size_t mask;
+    wsq_task *tasks;
+} wsq;
+
+typedef struct wsq_pool wsq_pool;
+
+typedef struct
+{
+    wsq_pool *pool;
+    wsq dq;
+    uint64_t rng;
+    pthread_t thread;
+} wsq_worker;
+
+struct wsq_pool
+{
+    wsq_worker *workers;
+    unsigned nworkers;
+    int stop;
+    pthread_mutex_t inject_lock;
+    bq inject;
+};
+
+static __thread wsq_worker *wsq_self_;
+
+/* Initializes the deque [q] on the ring of [len] tasks [tasks].
+ * [len] MUST be a power of 2. */
+static void wsq_init(wsq *q, wsq_task *tasks, size_t len)
+{
+    *q = (wsq){.top = 0, .bottom = 0, .mask = len - 1, .tasks = tasks};
+}
+
+/* Pushes [t] at the bottom of [q]. Owner only.
+ * Returns 0 on success, -1 if the deque is full. */
+static int wsq_push(wsq *q, wsq_task t)
+{
+    size_t b = q->bottom;
+    size_t top = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+    if (b - top > q->mask) return -1;
+
+    q->tasks[b & q->mask] = t;
+    // The task must be visible before the thieves see the new bottom
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Pops the task at the bottom of [q] into [*t]. Owner only.
+ * Returns 0 on success, -1 if the deque is empty. */
+static int wsq_pop(wsq *q, wsq_task *t)
+{
+    size_t b = q->bottom - 1;
+    __atomic_store_n(&q->bottom, b, __ATOMIC_RELAXED);
+    // Orders the bottom store before the top load, pairing with the
+    // fence in wsq_steal: either the owner sees the thief's top or the
+    // thief sees the owner's bottom.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    size_t top = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+
+    // Signed because b is top - 1 when the deque is empty
+    ptrdiff_t size = b - top;
+    if (size < 0)
+    {
+        __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    *t = q->tasks[b & q->mask];
+    if (size > 0) return 0;
+
+    // Last task: race with the thieves for it
+    int won = __atomic_compare_exchange_n(&q->top, &top, top + 1, 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+    return won ? 0 : -1;
+}
+
+/* Steals the task at the top of [q] into [*t]. Any thread.
+ * Returns 0 on success, -1 if the deque is empty or the race was lost. */
+static int wsq_steal(wsq *q, wsq_task *t)
+{
+    size_t top = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    size_t b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+    if ((ptrdiff_t)(b - top) <= 0) return -1;
+
+    // The slot may be overwritten by the owner as soon as top moves, so
+    // the copy is validated by the CAS
+    wsq_task *slot = q->tasks + (top & q->mask);
+    t->fn = __atomic_load_n(&slot->fn, __ATOMIC_RELAXED);
+    t->arg = __atomic_load_n(&slot->arg, __ATOMIC_RELAXED);
+    t->pending = __atomic_load_n(&slot->pending, __ATOMIC_RELAXED);
+
+    return __atomic_compare_exchange_n(&q->top, &top, top + 1, 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) ? 0 : -1;
+}
+
+static void wsq_run_(wsq_task t)
+{
+    t.fn(t.arg);
+    if (t.pending)
+        __atomic_sub_fetch(t.pending, 1, __ATOMIC_RELEASE);
+}
+
+/* Steals up to half of the tasks of [victim] into [*t] and the deque
+ * [own], owned by the caller. Returns the number of stolen tasks. */
+static size_t wsq_steal_half(wsq *victim, wsq *own, wsq_task *t)
+{
+    size_t b = __atomic_load_n(&victim->bottom, __ATOMIC_RELAXED);
+    size_t top = __atomic_load_n(&victim->top, __ATOMIC_RELAXED);
+    size_t want = (ptrdiff_t)(b - top) > 1 ? (b - top + 1) / 2 : 1;
+
+    if (wsq_steal(victim, t)) return 0;
+
+    size_t n = 1;
+    for (wsq_task extra; n < want && !wsq_steal(victim, &extra); n++)
+        // Own deque full: nothing is lost, run it right away
+        if (wsq_push(own, extra)) wsq_run_(extra);
+
+    return n;
+}
+
+/* Runs one task of [p] on behalf of [self] (NULL if the calling thread is
+ * not a worker): its own, a stolen one or an injected one.
+ * Returns 0 if a task was run, -1 if there was nothing to run. */
+static int wsq_run_one_(wsq_pool *p, wsq_worker *self)
+{
+    wsq_task t;
+
+    if (self && !wsq_pop(&self->dq, &t))
+    {
+        wsq_run_(t);
+        return 0;
+    }
+
+    if (p->nworkers)
+    {
+        // xorshift to pick the first victim
+        uint64_t r = self ? self->rng : (uintptr_t)&t;
+        r ^= r << 13; r ^= r >> 7; r ^= r << 17;
+        if (self) self->rng = r;
+
+        for (unsigned i = 0; i < p->nworkers; i++)
+        {
+            wsq_worker *v = p->workers + (r + i) % p->nworkers;
+            if (v == self) continue;
+            if (self ? wsq_steal_half(&v->dq, &self->dq, &t) : !wsq_steal(&v->dq, &t))
+            {
+                wsq_run_(t);
+                return 0;
+            }
+        }
+    }
+
+    size_t len = 0;
+    pthread_mutex_lock(&p->inject_lock);
+    wsq_task *it = bq_popbuf(&p->inject, &len);
+    if (len >= sizeof(t))
+    {
+        t = *it;
+        bq_pop(&p->inject, sizeof(t));
+    }
+    bq_disown(&p->inject, consumer);
+    pthread_mutex_unlock(&p->inject_lock);
+
+    if (len < sizeof(t)) return -1;
+    wsq_run_(t);
+    return 0;
+}
+
+static void *wsq_worker_thread_(void *arg)
+{
+    wsq_worker *self = arg;
+    wsq_self_ = self;
+
+    while (!__atomic_load_n(&self->pool->stop, __ATOMIC_ACQUIRE))
+        if (wsq_run_one_(self->pool, self))
+            sched_yield();
+
+    return NULL;
+}
+
+/* Starts the pool [p] with [nworkers] workers, each with a deque of
+ * [deque_len] tasks, and an injection ring of [inject_len] tasks.
+ * [deque_len] and [inject_len] MUST be powers of 2.
+ * Returns 0 on success, -1 on allocation failure. */
+static int wsq_pool_init(wsq_pool *p, unsigned nworkers, size_t deque_len, size_t inject_len)
+{
+    *p = (wsq_pool){.stop = 0};
+    p->workers = calloc(nworkers, sizeof(*p->workers));
+    wsq_task *tasks = malloc(nworkers * deque_len * sizeof(*tasks));
+    char *inject = malloc(inject_len * sizeof(wsq_task));
+    if (!p->workers || !tasks || !inject)
+    {
+        free(p->workers);
+        free(tasks);
+        free(inject);
+        return -1;
+    }
+
+    pthread_mutex_init(&p->inject_lock, NULL);
+    p->inject = bq_make(inject, inject_len * sizeof(wsq_task));
+
+    for (unsigned i = 0; i < nworkers; i++)
+    {
+        wsq_worker *w = p->workers + i;
+        w->pool = p;
+        w->rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+        wsq_init(&w->dq, tasks + i * deque_len, deque_len);
+    }
+
+    // Workers start only once all the deques they can steal from are ready
+    p->nworkers = nworkers;
+    for (unsigned i = 0; i < nworkers; i++)
+        pthread_create(&p->workers[i].thread, NULL, wsq_worker_thread_, p->workers + i);
+
+    return 0;
+}
+
+/* Stops the workers of [p], once they finish their current task, and
+ * releases the pool. Tasks still queued are not run. */
+static void wsq_pool_free(wsq_pool *p)
+{
+    __atomic_store_n(&p->stop, 1, __ATOMIC_RELEASE);
+    for (unsigned i = 0; i < p->nworkers; i++)
+        pthread_join(p->workers[i].thread, NULL);
+
+    if (p->nworkers) free(p->workers[0].dq.tasks);
+    free(p->workers);
+    free(p->inject.data);
+    pthread_mutex_destroy(&p->inject_lock);
+}
+
+/* Spawns the task [fn]([arg]) on [p]. If [pending] is not NULL, it is
+ * incremented now and decremented when the task is done.
+ * From a worker the task goes to its own deque, otherwise to the
+ * injection ring. When there is no room left the task is run inline. */
+static void wsq_spawn(wsq_pool *p, void (*fn)(void *), void *arg, size_t *pending)
+{
+    wsq_task t = {.fn = fn, .arg = arg, .pending = pending};
+    if (pending)
+        __atomic_add_fetch(pending, 1, __ATOMIC_RELAXED);
+
+    wsq_worker *self = wsq_self_;
+    if (self && self->pool == p)
+    {
+        if (wsq_push(&self->dq, t)) wsq_run_(t);
+        return;
+    }
+
+    size_t len;
+    pthread_mutex_lock(&p->inject_lock);
+    wsq_task *it = bq_pushbuf(&p->inject, &len);
+    if (len >= sizeof(t))
+    {
+        *it = t;
+        bq_push(&p->inject, sizeof(t));
+    }
+    bq_disown(&p->inject, producer);
+    pthread_mutex_unlock(&p->inject_lock);
+
+    if (len < sizeof(t)) wsq_run_(t);
+}
+
+/* Runs tasks of [p] until [*pending] drops to 0 */
+static void wsq_wait(wsq_pool *p, size_t *pending)
+{
+    wsq_worker *self = wsq_self_ && wsq_self_->pool == p ? wsq_self_ : NULL;
+
+    while (__atomic_load_n(pending, __ATOMIC_ACQUIRE))
+        if (wsq_run_one_(p, self))
+            sched_yield();
+}
+
+#endif